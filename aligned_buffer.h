@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdlib.h>
+
+#define ALIGNED_BYTES 64 // a cache line, a multiple of every SIMD width FFTW uses
+
+//
+// DSP arrays are allocated with aligned_new and held in an
+// AlignedBuffer so that every array starts on a cache line. FFTW plans
+// created on one such array can then be executed on any other with
+// fftwf_execute_dft, see FFTPlans::shared_dft. The element type has to
+// be trivially copyable, the memory is zero filled rather than
+// constructed.
+//
+struct AlignedFree
+{
+    void operator()(void *p) const { free(p); }
+};
+
+template <class T>
+using AlignedBuffer = std::unique_ptr<T[], AlignedFree>;
+
+template <class T>
+T *aligned_new(size_t n)
+{
+    void *p;
+    size_t bytes = n*sizeof(T);
+    if(bytes==0)
+        bytes = ALIGNED_BYTES;
+    if(posix_memalign(&p, ALIGNED_BYTES, bytes))
+        throw std::bad_alloc();
+    memset(p, 0, bytes);
+    return static_cast<T*>(p);
+}
@@ -0,0 +1,86 @@
+#include "almanac.h"
+#include <stdio.h>
+#include <cmath>
+
+Almanac::Almanac(void)
+{
+    for(int s=0;s<N_SATELLITES;s++){
+        valid[s] = false;
+    }
+}
+
+void Almanac::update(int sat, SV &sv)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!valid[sat]){
+        printf("Almanac::update satellite:%2d\n", sat+1);
+    }
+    svs[sat] = sv;
+    valid[sat] = true;
+}
+
+//
+// IS-GPS-200 Table 20-IV with the almanac parameters. The almanac
+// angles are stored in semicircles.
+//
+Vector3d Almanac::position(SV &sv, double t)
+{
+    double A = sv.sqrt_A*sv.sqrt_A;
+    double n = std::sqrt(mu_earth/(A*A*A));
+    double t_k = t - sv.t_oa;
+    if(t_k > 302400.0){
+        t_k -= 604800.0;
+    }else if(t_k < -302400.0){
+        t_k += 604800.0;
+    }
+    double M_k = sv.M_0*M_PI + n*t_k;
+    double E_k = M_k;
+    for(int i=0;i<10;i++){
+        E_k = E_k + (M_k - E_k + sv.e*std::sin(E_k))/(1.0 - sv.e*std::cos(E_k));
+    }
+    double v_k = 2.0*std::atan(std::sqrt((1+sv.e)/(1-sv.e))*std::tan(E_k/2));
+    double u_k = v_k + sv.omega*M_PI;
+    double r_k = A*(1 - sv.e*std::cos(E_k));
+    double i_k = sv.delta_i*M_PI;
+    double Omega_k = sv.Omega_0*M_PI + (sv.Omega_dot*M_PI - Omega_dot_e)*t_k
+                     - Omega_dot_e*sv.t_oa;
+    double x_k_p = r_k*std::cos(u_k);
+    double y_k_p = r_k*std::sin(u_k);
+    return Vector3d(x_k_p*std::cos(Omega_k) - y_k_p*std::cos(i_k)*std::sin(Omega_k),
+                    x_k_p*std::sin(Omega_k) + y_k_p*std::cos(i_k)*std::cos(Omega_k),
+                    y_k_p*std::sin(i_k));
+}
+
+int Almanac::predict(Vector3d &R, double t, AlmanacPrediction *predictions)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Vector3d up = R.normalized();
+    int n_visible = 0;
+    for(int s=0;s<N_SATELLITES;s++){
+        AlmanacPrediction &p = predictions[s];
+        p.known = false;
+        p.visible = false;
+        p.elevation = 0.0;
+        p.doppler = 0.0;
+        if(!valid[s])
+            continue;
+        // an unhealthy PRN is known, and never visible
+        p.known = true;
+        if(svs[s].health!=0)
+            continue;
+        Vector3d S = position(svs[s], t);
+        Vector3d los = S - R;
+        double range = los.norm();
+        los /= range;
+        p.elevation = std::asin(los.dot(up))*180.0/M_PI;
+        if(p.elevation < ALMANAC_ELEVATION_MASK)
+            continue;
+        // the receiver is fixed in ECEF, difference the orbit for the velocity
+        Vector3d V = position(svs[s], t + 0.5) - position(svs[s], t - 0.5);
+        double range_rate = V.dot(los);
+        p.doppler = -range_rate*L1_FREQ/speed_of_light;
+        p.visible = true;
+        n_visible++;
+    }
+    return n_visible;
+}
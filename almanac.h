@@ -0,0 +1,39 @@
+#pragma once
+
+#include "constants.h"
+#include "lnav.h"
+#include <mutex>
+#include <Eigen/Dense>
+
+#define L1_FREQ 1575.42e6
+#define ALMANAC_ELEVATION_MASK 5.0 // degrees
+
+using namespace Eigen;
+
+struct AlmanacPrediction
+{
+    bool known;   // an almanac entry, false for pages not received
+    bool visible;
+    double elevation; // degrees
+    double doppler;   // Hz
+};
+
+//
+// Almanac pages collected from the subframe 5 decodes of every
+// channel. predict() propagates the orbits to a GPS time of week and
+// reports which PRNs are above the elevation mask of a rough receiver
+// position and the Doppler they should arrive with. A PRN without a
+// page, 25-32 whose pages are in subframe 4 among them, is unknown
+// rather than below the mask.
+//
+struct Almanac
+{
+    std::mutex mutex;
+    SV svs[N_SATELLITES];
+    bool valid[N_SATELLITES];
+
+    Almanac(void);
+    void update(int sat, SV &sv);
+    Vector3d position(SV &sv, double t);
+    int predict(Vector3d &R, double t, AlmanacPrediction *predictions);
+};
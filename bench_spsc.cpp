@@ -0,0 +1,141 @@
+//
+// Latency of SPSCRing, the scheduler and triangulator queues, against
+// the mutex and condition variable ThreadQueue it replaced.
+//
+// round trip: a message bounced through a pair of queues by a second
+//             thread, one at a time, measured at the sender
+// push/pop:   one way, the consumer stamping each message against the
+//             time it was pushed, the producer sleeping between pushes
+//             so the consumer waits on an empty queue as in the receiver
+// stream:     back to back pushes, per message cost with the queue busy
+//
+#include "spsc_ring.h"
+#include "queue.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#define BENCH_ROUND_TRIPS 200000
+#define BENCH_ONE_WAY 50000
+#define BENCH_STREAM 2000000
+#define BENCH_PACE_US 20 // producer sleep between one way pushes
+#define BENCH_RING_SIZE 16
+
+typedef std::chrono::steady_clock bench_clock;
+typedef std::shared_ptr<long> Msg; // as the scheduler passes shared_ptr<SSIQ>
+
+static long now_ns(void)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        bench_clock::now().time_since_epoch()).count();
+}
+
+static void print_stats(const char *name, const char *test, std::vector<long> &ns)
+{
+    std::sort(ns.begin(), ns.end());
+    double mean = 0.0;
+    for(long t : ns){
+        mean += t;
+    }
+    mean /= ns.size();
+    printf("%-12s %-10s mean:%8.0f ns p50:%8ld ns p99:%8ld ns\n", name, test, mean,
+           ns[ns.size()/2], ns[ns.size()*99/100]);
+}
+
+// thin adaptors so both queues run the same tests
+struct RingQueue
+{
+    SPSCRing<Msg, BENCH_RING_SIZE> ring;
+    void push(Msg m){ ring.push(std::move(m)); }
+    Msg pop(void){ Msg m; ring.pop(m); return m; }
+    static const char *name(void){ return "SPSCRing"; }
+};
+
+struct LockedQueue
+{
+    ThreadQueue<Msg> queue;
+    void push(Msg m){ queue.push(std::move(m)); }
+    Msg pop(void){ return queue.pop(); }
+    static const char *name(void){ return "ThreadQueue"; }
+};
+
+template <class Q>
+void round_trip(void)
+{
+    Q a, b;
+    std::vector<long> ns(BENCH_ROUND_TRIPS);
+    std::thread echo([&]{
+        for(int i=0;i<BENCH_ROUND_TRIPS;i++){
+            b.push(a.pop());
+        }
+    });
+    Msg m = std::make_shared<long>(0);
+    for(int i=0;i<BENCH_ROUND_TRIPS;i++){
+        long t0 = now_ns();
+        a.push(m);
+        m = b.pop();
+        ns[i] = now_ns() - t0;
+    }
+    echo.join();
+    print_stats(Q::name(), "round trip", ns);
+}
+
+template <class Q>
+void one_way(void)
+{
+    Q q;
+    std::vector<long> ns(BENCH_ONE_WAY);
+    std::thread consumer([&]{
+        for(int i=0;i<BENCH_ONE_WAY;i++){
+            Msg m = q.pop();
+            ns[i] = now_ns() - *m;
+        }
+    });
+    for(int i=0;i<BENCH_ONE_WAY;i++){
+        std::this_thread::sleep_for(std::chrono::microseconds(BENCH_PACE_US));
+        q.push(std::make_shared<long>(now_ns()));
+    }
+    consumer.join();
+    print_stats(Q::name(), "push/pop", ns);
+}
+
+template <class Q>
+void stream(void)
+{
+    Q q;
+    std::vector<Msg> msgs(BENCH_STREAM);
+    for(int i=0;i<BENCH_STREAM;i++){
+        msgs[i] = std::make_shared<long>(i);
+    }
+    long t0 = now_ns();
+    std::thread consumer([&]{
+        for(int i=0;i<BENCH_STREAM;i++){
+            Msg m = q.pop();
+            if(*m != i){
+                printf("%s out of order at %d\n", Q::name(), i);
+                return;
+            }
+        }
+    });
+    for(int i=0;i<BENCH_STREAM;i++){
+        q.push(std::move(msgs[i]));
+    }
+    consumer.join();
+    printf("%-12s %-10s %8.1f ns/message\n", Q::name(), "stream",
+           (double)(now_ns() - t0)/BENCH_STREAM);
+}
+
+int main(void)
+{
+    printf("hardware threads:%u\n", std::thread::hardware_concurrency());
+    round_trip<RingQueue>();
+    round_trip<LockedQueue>();
+    one_way<RingQueue>();
+    one_way<LockedQueue>();
+    stream<RingQueue>();
+    stream<LockedQueue>();
+    return 0;
+}
@@ -8,6 +8,7 @@ DCO::DCO(float fs):
     theta = 0.0f;
     f = 0.0f;
     dtheta = 0.0f;
+    steps_valid = false;
 }
 
 std::complex<float> DCO::evaluate(void)
@@ -24,10 +25,75 @@ std::complex<float> DCO::evaluate(void)
     return t;
 }
 
+void DCO::update_steps(void)
+{
+    for(int k=0;k<DCO_CHUNK;k++){
+        sincosf(k*dtheta, &step_im[k], &step_re[k]);
+    }
+    steps_valid = true;
+}
+
+void DCO::wrap(void)
+{
+    theta -= 2*M_PI*floorf(theta/(2*M_PI));
+}
+
+void DCO::generate(std::complex<float> *out, int n)
+{
+    if(!steps_valid)
+        update_steps();
+    for(int i=0;i<n;i+=DCO_CHUNK){
+        int m = (n-i<DCO_CHUNK)?n-i:DCO_CHUNK;
+        float r,im;
+        sincosf(theta, &im, &r);
+        float *o = reinterpret_cast<float*>(out+i);
+        for(int k=0;k<m;k++){
+            o[2*k] = r*step_re[k] - im*step_im[k];
+            o[2*k+1] = r*step_im[k] + im*step_re[k];
+        }
+        theta += m*dtheta;
+        wrap();
+    }
+}
+
+void DCO::mix(const std::complex<float> *in, std::complex<float> *out, int n)
+{
+    if(!steps_valid)
+        update_steps();
+    for(int i=0;i<n;i+=DCO_CHUNK){
+        int m = (n-i<DCO_CHUNK)?n-i:DCO_CHUNK;
+        float r,im;
+        sincosf(theta, &im, &r);
+        const float *x = reinterpret_cast<const float*>(in+i);
+        float *o = reinterpret_cast<float*>(out+i);
+        for(int k=0;k<m;k++){
+            float lo_re = r*step_re[k] - im*step_im[k];
+            float lo_im = r*step_im[k] + im*step_re[k];
+            float x_re = x[2*k];
+            float x_im = x[2*k+1];
+            o[2*k] = x_re*lo_re - x_im*lo_im;
+            o[2*k+1] = x_re*lo_im + x_im*lo_re;
+        }
+        theta += m*dtheta;
+        wrap();
+    }
+}
+
+void DCO::skip(int n)
+{
+    // in chunks to keep the float phase increments as small as evaluate's
+    for(int i=0;i<n;i+=DCO_CHUNK){
+        int m = (n-i<DCO_CHUNK)?n-i:DCO_CHUNK;
+        theta += m*dtheta;
+        wrap();
+    }
+}
+
 void DCO::set_frequency(float f)
 {
     DCO::f = f;
     dtheta = 2*M_PI*f/fs;
+    steps_valid = false;
 }
 
 float DCO::get_frequency(void)
@@ -2,15 +2,32 @@
 
 #include <complex>
 
+#define DCO_CHUNK 64 // samples per exact phasor in the block API
+
+//
+// evaluate() returns one sample at a time. generate() and mix() work on
+// blocks: each DCO_CHUNK samples start from an exact sincos of theta and
+// step with a table of exp(i*k*dtheta), k<DCO_CHUNK, so the error never
+// builds up and the inner loops have no dependency between samples. The
+// table is rebuilt lazily after a frequency change.
+//
 class DCO
 {
     float theta;
     float dtheta;
     float fs;
     float f;
+    bool steps_valid;
+    float step_re[DCO_CHUNK];
+    float step_im[DCO_CHUNK];
+    void update_steps(void);
+    void wrap(void);
 public:
     DCO(float fs);
     std::complex<float> evaluate(void);
+    void generate(std::complex<float> *out, int n);
+    void mix(const std::complex<float> *in, std::complex<float> *out, int n);
+    void skip(int n);
     void set_frequency(float f);
     float get_frequency(void);
     void add_frequency(float offset);
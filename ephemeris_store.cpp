@@ -0,0 +1,243 @@
+#include "ephemeris_store.h"
+#include <stdio.h>
+#include <time.h>
+#include <cmath>
+
+EphemerisStore::EphemerisStore(const char *path)
+    :path(path)
+{
+    dirty = false;
+    stopping = false;
+    for(int s=0;s<N_SATELLITES;s++){
+        ephemeris_valid[s] = false;
+        page_valid[s] = false;
+    }
+    thread = std::thread(&EphemerisStore::thread_func, this);
+}
+
+EphemerisStore::~EphemerisStore()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_one();
+    // writes anything still unsaved before it exits
+    thread.join();
+}
+
+void EphemerisStore::thread_func(void)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true){
+        changed.wait(lock, [this]{ return dirty || stopping; });
+        if(!dirty)
+            break;
+        lock.unlock();
+        save();
+        lock.lock();
+        changed.wait_for(lock, std::chrono::seconds(EPHEMERIS_STORE_SAVE_INTERVAL),
+                         [this]{ return stopping; });
+    }
+}
+
+//
+// File layout: magic, version, n_ephemeris then (prn, StoredEphemeris)
+// records, n_pages then (page, StoredAlmanacPage) records. Anything
+// that doesn't parse leaves the store empty, a cold start.
+//
+void EphemerisStore::load(Almanac &almanac)
+{
+    FILE *f = fopen(path, "rb");
+    if(!f){
+        printf("EphemerisStore::load no store at %s, cold start.\n", path);
+        return;
+    }
+    int64_t now = time(nullptr);
+    bool eph_read[N_SATELLITES];
+    StoredEphemeris eph[N_SATELLITES];
+    bool page_read[N_SATELLITES];
+    StoredAlmanacPage page[N_SATELLITES];
+    for(int s=0;s<N_SATELLITES;s++){
+        eph_read[s] = false;
+        page_read[s] = false;
+    }
+    uint32_t header[3];
+    bool ok = fread(header, sizeof(header), 1, f)==1 &&
+              header[0]==EPHEMERIS_STORE_MAGIC &&
+              header[1]==EPHEMERIS_STORE_VERSION &&
+              header[2]<=N_SATELLITES;
+    for(uint32_t i=0;ok && i<header[2];i++){
+        int32_t prn;
+        StoredEphemeris e;
+        ok = fread(&prn, sizeof(prn), 1, f)==1 && fread(&e, sizeof(e), 1, f)==1 &&
+             prn>=1 && prn<=N_SATELLITES;
+        if(ok && now-e.saved<=EPHEMERIS_STORE_MAX_AGE){
+            eph[prn-1] = e;
+            eph_read[prn-1] = true;
+        }
+    }
+    uint32_t n_pages = 0;
+    ok = ok && fread(&n_pages, sizeof(n_pages), 1, f)==1 && n_pages<=N_SATELLITES;
+    for(uint32_t i=0;ok && i<n_pages;i++){
+        int32_t p;
+        StoredAlmanacPage a;
+        ok = fread(&p, sizeof(p), 1, f)==1 && fread(&a, sizeof(a), 1, f)==1 &&
+             p>=1 && p<=N_SATELLITES;
+        if(ok && now-a.saved<=ALMANAC_STORE_MAX_AGE){
+            page[p-1] = a;
+            page_read[p-1] = true;
+        }
+    }
+    fclose(f);
+    if(!ok){
+        printf("EphemerisStore::load %s is not a valid store, cold start.\n", path);
+        return;
+    }
+
+    // decode the almanac pages through the subframe 5 path
+    LNAV decoder;
+    int n_ephemeris = 0;
+    int n_almanac = 0;
+    std::lock_guard<std::mutex> lock(mutex);
+    for(int s=0;s<N_SATELLITES;s++){
+        if(eph_read[s]){
+            ephemeris[s] = eph[s];
+            ephemeris_valid[s] = true;
+            n_ephemeris++;
+        }
+        if(page_read[s]){
+            pages[s] = page[s];
+            page_valid[s] = true;
+            for(int w=0;w<EPHEMERIS_STORE_WORDS;w++){
+                decoder.frame[SUBFRAME5][w+2] = page[s].words[w];
+            }
+            int p;
+            decoder.almanac_decode(p);
+            if(p==s+1){
+                almanac.update(s, decoder.svs[s]);
+                n_almanac++;
+            }
+        }
+    }
+    printf("EphemerisStore::load ephemerides:%d almanac pages:%d\n", n_ephemeris, n_almanac);
+}
+
+void EphemerisStore::save(void)
+{
+    uint32_t header[3];
+    StoredEphemeris eph[N_SATELLITES];
+    StoredAlmanacPage page[N_SATELLITES];
+    int32_t eph_prn[N_SATELLITES];
+    int32_t page_id[N_SATELLITES];
+    uint32_t n_pages = 0;
+    header[0] = EPHEMERIS_STORE_MAGIC;
+    header[1] = EPHEMERIS_STORE_VERSION;
+    header[2] = 0;
+    {
+        // snapshot under the lock, write without it
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!dirty)
+            return;
+        dirty = false;
+        for(int s=0;s<N_SATELLITES;s++){
+            if(ephemeris_valid[s]){
+                eph_prn[header[2]] = s+1;
+                eph[header[2]++] = ephemeris[s];
+            }
+            if(page_valid[s]){
+                page_id[n_pages] = s+1;
+                page[n_pages++] = pages[s];
+            }
+        }
+    }
+    // write beside the store and rename so a crash never leaves half a file
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *f = fopen(tmp_path, "wb");
+    if(!f){
+        printf("EphemerisStore::save couldn't open %s\n", tmp_path);
+        return;
+    }
+    bool ok = fwrite(header, sizeof(header), 1, f)==1;
+    for(uint32_t i=0;ok && i<header[2];i++){
+        ok = fwrite(&eph_prn[i], sizeof(eph_prn[i]), 1, f)==1 &&
+             fwrite(&eph[i], sizeof(eph[i]), 1, f)==1;
+    }
+    ok = ok && fwrite(&n_pages, sizeof(n_pages), 1, f)==1;
+    for(uint32_t i=0;ok && i<n_pages;i++){
+        ok = fwrite(&page_id[i], sizeof(page_id[i]), 1, f)==1 &&
+             fwrite(&page[i], sizeof(page[i]), 1, f)==1;
+    }
+    ok = (fclose(f)==0) && ok;
+    if(!ok || rename(tmp_path, path)!=0){
+        printf("EphemerisStore::save failed to write %s\n", path);
+        remove(tmp_path);
+    }
+}
+
+void EphemerisStore::update_ephemeris(int sat, LNAV &lnav)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    StoredEphemeris &e = ephemeris[sat];
+    e.saved = time(nullptr);
+    e.iode = lnav.IODE2;
+    e.fit_interval = lnav.FitInterval;
+    e.t_oe = lnav.t_oe;
+    for(int s=0;s<3;s++){
+        for(int w=0;w<EPHEMERIS_STORE_WORDS;w++){
+            e.words[s][w] = lnav.frame[s][w+2];
+        }
+    }
+    ephemeris_valid[sat] = true;
+    dirty = true;
+    changed.notify_one();
+}
+
+void EphemerisStore::update_almanac(int page, LNAV &lnav)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    StoredAlmanacPage &a = pages[page];
+    a.saved = time(nullptr);
+    for(int w=0;w<EPHEMERIS_STORE_WORDS;w++){
+        a.words[w] = lnav.frame[SUBFRAME5][w+2];
+    }
+    page_valid[page] = true;
+    dirty = true;
+    changed.notify_one();
+}
+
+//
+// Hands the stored subframes 1-3 of sat to a channel that has just
+// decoded a HOW, if the time of week falls inside the fit interval
+// around t_oe (IS-GPS-200 20.3.4.4, 4 hours or, with the flag set,
+// at least 6). Returns true when lnav decoded a valid ephemeris.
+//
+bool EphemerisStore::restore(int sat, LNAV &lnav, int subframe)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!ephemeris_valid[sat])
+        return false;
+    StoredEphemeris &e = ephemeris[sat];
+    double t = lnav.tlm_how[subframe-1].time_of_week*6.0;
+    double dt = t - e.t_oe;
+    if(dt > 302400.0){
+        dt -= 604800.0;
+    }else if(dt < -302400.0){
+        dt += 604800.0;
+    }
+    double fit = (e.fit_interval ? 6.0 : 4.0)*3600.0;
+    if(std::fabs(dt) > fit/2){
+        printf("EphemerisStore::restore satellite:%2d IODE:%d outside its fit interval dt:%.0lf\n",
+               sat+1, e.iode, dt);
+        ephemeris_valid[sat] = false;
+        return false;
+    }
+    for(int s=0;s<3;s++){
+        for(int w=0;w<EPHEMERIS_STORE_WORDS;w++){
+            lnav.frame[s][w+2] = e.words[s][w];
+        }
+        lnav.ephemeris_held[s] = true;
+    }
+    return lnav.ephemeris_update();
+}
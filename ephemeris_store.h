@@ -0,0 +1,67 @@
+#pragma once
+
+#include "constants.h"
+#include "lnav.h"
+#include "almanac.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <stdint.h>
+
+#define EPHEMERIS_STORE_FILE "ephemeris.bin"
+#define EPHEMERIS_STORE_MAGIC 0x53504547 // "GEPS"
+#define EPHEMERIS_STORE_VERSION 1
+#define EPHEMERIS_STORE_WORDS (WORDS_PER_SUBFRAME-2) // words 3-10, no TLM/HOW
+#define EPHEMERIS_STORE_MAX_AGE (24*3600)   // s, keeps t_oe in the current week
+#define ALMANAC_STORE_MAX_AGE (7*24*3600)  // s
+#define EPHEMERIS_STORE_SAVE_INTERVAL 10  // s, at most one save per interval
+
+struct StoredEphemeris
+{
+    int64_t saved; // unix time of the decode
+    int32_t iode;
+    int32_t fit_interval; // sf2 word10 17, 0: 4 hour fit
+    double t_oe;
+    int32_t words[3][EPHEMERIS_STORE_WORDS]; // subframes 1-3
+};
+
+struct StoredAlmanacPage
+{
+    int64_t saved;
+    int32_t words[EPHEMERIS_STORE_WORDS]; // subframe 5
+};
+
+//
+// Hot start cache of the navigation data. The parity checked words of
+// subframes 1-3 of every PRN and the subframe 5 almanac pages are kept
+// as received and written to a small binary file in host byte order.
+// At startup the almanac pages go straight to the Almanac, the
+// ephemerides wait in the store until a channel decodes its first HOW
+// and can check the time of week against t_oe and the fit interval.
+// Channels update the store from the workers. The file is written by
+// the store's own thread, woken by an update and then holding off for
+// EPHEMERIS_STORE_SAVE_INTERVAL so a burst of almanac pages is written
+// once, so neither the sample input nor the tracking see file I/O.
+//
+struct EphemerisStore
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread thread;
+    const char *path;
+    bool dirty;
+    bool stopping;
+    bool ephemeris_valid[N_SATELLITES];
+    StoredEphemeris ephemeris[N_SATELLITES];
+    bool page_valid[N_SATELLITES];
+    StoredAlmanacPage pages[N_SATELLITES];
+
+    EphemerisStore(const char *path);
+    ~EphemerisStore();
+    void load(Almanac &almanac);
+    void save(void);
+    void thread_func(void);
+    void update_ephemeris(int sat, LNAV &lnav);
+    void update_almanac(int page, LNAV &lnav);
+    bool restore(int sat, LNAV &lnav, int subframe);
+};
@@ -0,0 +1,81 @@
+#include "fft_plans.h"
+#include <stdio.h>
+
+FFTPlans::FFTPlans(const char *wisdom_file, unsigned flags)
+    :wisdom_file(wisdom_file), flags(flags)
+{
+    if(fftwf_import_wisdom_from_filename(wisdom_file)){
+        printf("FFTPlans::FFTPlans loaded wisdom from %s\n", wisdom_file);
+    }else{
+        printf("FFTPlans::FFTPlans no wisdom in %s\n", wisdom_file);
+    }
+}
+
+FFTPlans::~FFTPlans()
+{
+    for(auto &p : shared){
+        fftwf_destroy_plan(p.second);
+    }
+}
+
+fftwf_plan FFTPlans::shared_dft(int n, int howmany, int sign)
+{
+    std::lock_guard<std::mutex> lock(shared_plans_mutex);
+    std::tuple<int,int,int> key(n, howmany, sign);
+    auto it = shared.find(key);
+    if(it != shared.end())
+        return it->second;
+    AlignedBuffer<std::complex<float>> in(aligned_new<std::complex<float>>(n*howmany));
+    AlignedBuffer<std::complex<float>> out(aligned_new<std::complex<float>>(n*howmany));
+    fftwf_plan plan;
+    if(howmany==1){
+        plan = dft_1d(n, in.get(), out.get(), sign);
+    }else{
+        plan = many_dft(n, howmany, in.get(), out.get(), sign);
+    }
+    shared[key] = plan;
+    return plan;
+}
+
+fftwf_plan FFTPlans::dft_1d(int n, std::complex<float> *in, std::complex<float> *out, int sign)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    fftwf_complex *in_p = reinterpret_cast<fftwf_complex*>(in);
+    fftwf_complex *out_p = reinterpret_cast<fftwf_complex*>(out);
+    fftwf_plan plan = fftwf_plan_dft_1d(n, in_p, out_p, sign, flags|FFTW_WISDOM_ONLY);
+    if(plan == nullptr){
+        printf("FFTPlans::dft_1d measuring n:%d sign:%d\n", n, sign);
+        plan = fftwf_plan_dft_1d(n, in_p, out_p, sign, flags);
+        save_wisdom();
+    }
+    return plan;
+}
+
+fftwf_plan FFTPlans::many_dft(int n, int howmany,
+                              std::complex<float> *in, std::complex<float> *out, int sign)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    fftwf_complex *in_p = reinterpret_cast<fftwf_complex*>(in);
+    fftwf_complex *out_p = reinterpret_cast<fftwf_complex*>(out);
+    fftwf_plan plan = fftwf_plan_many_dft(1, &n, howmany,
+                                          in_p, nullptr, 1, n,
+                                          out_p, nullptr, 1, n,
+                                          sign, flags|FFTW_WISDOM_ONLY);
+    if(plan == nullptr){
+        printf("FFTPlans::many_dft measuring n:%d howmany:%d sign:%d\n", n, howmany, sign);
+        plan = fftwf_plan_many_dft(1, &n, howmany,
+                                   in_p, nullptr, 1, n,
+                                   out_p, nullptr, 1, n,
+                                   sign, flags);
+        save_wisdom();
+    }
+    return plan;
+}
+
+void FFTPlans::save_wisdom(void)
+{
+    // called with the mutex held
+    if(!fftwf_export_wisdom_to_filename(wisdom_file.c_str())){
+        printf("FFTPlans::save_wisdom couldn't write %s\n", wisdom_file.c_str());
+    }
+}
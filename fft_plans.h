@@ -0,0 +1,48 @@
+#pragma once
+
+#include "aligned_buffer.h"
+#include <complex>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <fftw3.h>
+
+#define FFT_WISDOM_FILE "gps.wisdom"
+#define FFT_PLAN_FLAGS FFTW_MEASURE
+
+//
+// All FFTW plans are created through FFTPlans. Planning and plan
+// destruction are serialized since FFTW's planner isn't thread safe.
+// Wisdom is loaded from wisdom_file at construction and written back
+// whenever a plan had to be measured, so FFTW_MEASURE/FFTW_PATIENT
+// planning is only paid on the first run for each transform.
+//
+// Measured planning overwrites the in and out arrays. Plans must be
+// created before the arrays are filled.
+//
+// shared_dft returns a plan that is made once per (n, howmany, sign)
+// on scratch arrays and owned by FFTPlans. It is run on the caller's
+// own AlignedBuffer arrays, out of place, with execute().
+//
+struct FFTPlans
+{
+    std::string wisdom_file;
+    unsigned flags;
+    std::mutex mutex;
+    std::mutex shared_plans_mutex; // guards shared
+    std::map<std::tuple<int,int,int>, fftwf_plan> shared;
+
+    FFTPlans(const char *wisdom_file=FFT_WISDOM_FILE, unsigned flags=FFT_PLAN_FLAGS);
+    ~FFTPlans();
+    fftwf_plan dft_1d(int n, std::complex<float> *in, std::complex<float> *out, int sign);
+    fftwf_plan many_dft(int n, int howmany,
+                        std::complex<float> *in, std::complex<float> *out, int sign);
+    fftwf_plan shared_dft(int n, int howmany, int sign);
+    static void execute(fftwf_plan plan, std::complex<float> *in, std::complex<float> *out)
+    {
+        fftwf_execute_dft(plan, reinterpret_cast<fftwf_complex*>(in),
+                          reinterpret_cast<fftwf_complex*>(out));
+    }
+    void save_wisdom(void);
+};
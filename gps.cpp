@@ -2,39 +2,47 @@
 #include <stdio.h>
 
 GPSRx::GPSRx(int fs)
-    :fs(fs), prns(fs), triangulator(fs)
+    :fs(fs), ssiq_pool(fs/F_BUFFER), prns(fs, plans),
+    ephemeris_store(EPHEMERIS_STORE_FILE),
+    triangulator(fs, 1+ChannelScheduler::workers(SCHED_N_WORKERS))
 {
     int samples_per_chip = fs/F_CHIP;
     if(samples_per_chip*F_CHIP != fs){
         printf("Sample rate is not an integer multiple of the chip rate, 1.023e6.\n");
         throw;
     }
+    if(fs%MEAS_RATE){
+        printf("Sample rate is not an integer multiple of the measurement rate, %d.\n", MEAS_RATE);
+        throw;
+    }
     samples_per_buffer = fs/F_BUFFER;
     buffer_index = 0;
     sample_index = 0;
     search.reset(new Search(*this, fs));
     sensors.reset(new Sensors);
+    ephemeris_store.load(almanac);
 }
 
 void GPSRx::evaluate(std::complex<float> x){
     if(buffer_index==0){
-        ssiq.reset(new SSIQ(sample_index, samples_per_buffer));
+        ssiq = ssiq_pool.acquire(sample_index);
     }
     ssiq->iq[buffer_index] = x;
     if(++buffer_index==samples_per_buffer){
         buffer_index = 0;
-        // send this buffer to active satellites
-        // and destroy inactive satellites
+        // destroy inactive satellites
+        // and send this buffer to the active ones
         std::list<std::unique_ptr<Satellite>>::iterator s_it = satellites.begin();
         for(;s_it!=satellites.end();){
             if((*s_it)->is_active()){
-                (*s_it)->send_ssiq(ssiq);
                 s_it++;
             }else{
-                triangulator.send_del_message((*s_it)->sat);
+                scheduler.remove(s_it->get());
+                triangulator.send_del_message(0, (*s_it)->sat);
                 s_it = satellites.erase(s_it);
             }
         }
+        scheduler.dispatch(ssiq);
     }
     search->evaluate(x);
     sample_index++;
@@ -62,8 +70,22 @@ void GPSRx::select_satellites(void)
                                                          found_sat->sat,
                                                          fs,
                                                          found_sat->freq)));
+            scheduler.add(satellites.front().get());
         }
     }
+    scheduler.report();
+    ssiq_pool.report();
+}
+
+void GPSRx::tracked(bool *tracked)
+{
+    // flag the PRNs that have a channel, tracked[N_SATELLITES]
+    for(int s=0;s<N_SATELLITES;s++){
+        tracked[s] = false;
+    }
+    for(auto &sat : satellites){
+        tracked[sat->sat] = true;
+    }
 }
 
 
@@ -1,8 +1,12 @@
 #pragma once
 
+#include "fft_plans.h"
 #include "prns.h"
+#include "almanac.h"
+#include "ephemeris_store.h"
 #include "ssiq.h"
 #include "satellite.h"
+#include "scheduler.h"
 #include "search.h"
 #include "triangulate.h"
 #include "sensors.h"
@@ -14,15 +18,21 @@ struct GPSRx
     int samples_per_buffer;
     int buffer_index;
     long sample_index;
+    SSIQPool ssiq_pool; // before ssiq, outlives the buffers handed out
     std::shared_ptr<SSIQ> ssiq;
+    FFTPlans plans;
     PRNS prns;
+    Almanac almanac;
+    EphemerisStore ephemeris_store;
     Triangulator triangulator;
     std::unique_ptr<Search> search;
     std::unique_ptr<Sensors> sensors;
     std::list<std::unique_ptr<Satellite>> satellites;
+    ChannelScheduler scheduler; // after satellites, its workers stop first
 public:
     GPSRx(int fs);
 
     void evaluate(std::complex<float> x);
     void select_satellites(void);
+    void tracked(bool *tracked);
 };
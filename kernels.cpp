@@ -0,0 +1,296 @@
+#include "kernels.h"
+#include <cmath>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX2__)
+
+// |x|^2 of eight complex values in order
+static inline __m256 norm8(const std::complex<float> *x)
+{
+    __m256 a = _mm256_loadu_ps(reinterpret_cast<const float*>(x));
+    __m256 b = _mm256_loadu_ps(reinterpret_cast<const float*>(x+4));
+    a = _mm256_mul_ps(a, a);
+    b = _mm256_mul_ps(b, b);
+    // per 128 bit lane: a0 a1 b0 b1 | a2 a3 b2 b3
+    __m256 p = _mm256_hadd_ps(a, b);
+    return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(p), 0xD8));
+}
+
+static inline float argmax_reduce(__m256 vmax, __m256i vidx, int &index)
+{
+    alignas(32) float m[8];
+    alignas(32) int idx[8];
+    _mm256_store_ps(m, vmax);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(idx), vidx);
+    float max = m[0];
+    index = idx[0];
+    for(int l=1;l<8;l++){
+        if(m[l] > max || (m[l] == max && idx[l] < index)){
+            max = m[l];
+            index = idx[l];
+        }
+    }
+    return max;
+}
+
+#elif defined(__SSE2__)
+
+// |x|^2 of four complex values in order
+static inline __m128 norm4(const std::complex<float> *x)
+{
+    __m128 a = _mm_loadu_ps(reinterpret_cast<const float*>(x));
+    __m128 b = _mm_loadu_ps(reinterpret_cast<const float*>(x+2));
+    a = _mm_mul_ps(a, a);
+    b = _mm_mul_ps(b, b);
+    __m128 re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+    __m128 im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+    return _mm_add_ps(re, im);
+}
+
+static inline float argmax_reduce(__m128 vmax, __m128i vidx, int &index)
+{
+    alignas(16) float m[4];
+    alignas(16) int idx[4];
+    _mm_store_ps(m, vmax);
+    _mm_store_si128(reinterpret_cast<__m128i*>(idx), vidx);
+    float max = m[0];
+    index = idx[0];
+    for(int l=1;l<4;l++){
+        if(m[l] > max || (m[l] == max && idx[l] < index)){
+            max = m[l];
+            index = idx[l];
+        }
+    }
+    return max;
+}
+
+#endif
+
+void kernel_acc_abs(float *acc, const std::complex<float> *x, int n)
+{
+    int i = 0;
+#if defined(__AVX2__)
+    for(;i+8<=n;i+=8){
+        __m256 m = _mm256_sqrt_ps(norm8(x+i));
+        _mm256_storeu_ps(acc+i, _mm256_add_ps(_mm256_loadu_ps(acc+i), m));
+    }
+#elif defined(__SSE2__)
+    for(;i+4<=n;i+=4){
+        __m128 m = _mm_sqrt_ps(norm4(x+i));
+        _mm_storeu_ps(acc+i, _mm_add_ps(_mm_loadu_ps(acc+i), m));
+    }
+#endif
+    for(;i<n;i++){
+        acc[i] += std::sqrt(std::norm(x[i]));
+    }
+}
+
+void kernel_acc_norm(float *acc, const std::complex<float> *x, int n)
+{
+    int i = 0;
+#if defined(__AVX2__)
+    for(;i+8<=n;i+=8){
+        _mm256_storeu_ps(acc+i, _mm256_add_ps(_mm256_loadu_ps(acc+i), norm8(x+i)));
+    }
+#elif defined(__SSE2__)
+    for(;i+4<=n;i+=4){
+        _mm_storeu_ps(acc+i, _mm_add_ps(_mm_loadu_ps(acc+i), norm4(x+i)));
+    }
+#endif
+    for(;i<n;i++){
+        acc[i] += std::norm(x[i]);
+    }
+}
+
+float kernel_max_index(const float *x, int n, int &index)
+{
+    int i = 0;
+    float max = -INFINITY;
+    index = 0;
+#if defined(__AVX2__)
+    if(n>=8){
+        __m256 vmax = _mm256_loadu_ps(x);
+        __m256i vidx = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+        __m256i vcur = vidx;
+        __m256i vstep = _mm256_set1_epi32(8);
+        for(i=8;i+8<=n;i+=8){
+            __m256 v = _mm256_loadu_ps(x+i);
+            vcur = _mm256_add_epi32(vcur, vstep);
+            __m256 gt = _mm256_cmp_ps(v, vmax, _CMP_GT_OQ);
+            vmax = _mm256_blendv_ps(vmax, v, gt);
+            vidx = _mm256_castps_si256(_mm256_blendv_ps(
+                _mm256_castsi256_ps(vidx), _mm256_castsi256_ps(vcur), gt));
+        }
+        max = argmax_reduce(vmax, vidx, index);
+    }
+#elif defined(__SSE2__)
+    if(n>=4){
+        __m128 vmax = _mm_loadu_ps(x);
+        __m128i vidx = _mm_setr_epi32(0,1,2,3);
+        __m128i vcur = vidx;
+        __m128i vstep = _mm_set1_epi32(4);
+        for(i=4;i+4<=n;i+=4){
+            __m128 v = _mm_loadu_ps(x+i);
+            vcur = _mm_add_epi32(vcur, vstep);
+            __m128 gt = _mm_cmpgt_ps(v, vmax);
+            vmax = _mm_or_ps(_mm_and_ps(gt, v), _mm_andnot_ps(gt, vmax));
+            __m128 gti = _mm_and_ps(gt, _mm_castsi128_ps(vcur));
+            vidx = _mm_castps_si128(_mm_or_ps(gti, _mm_andnot_ps(gt, _mm_castsi128_ps(vidx))));
+        }
+        max = argmax_reduce(vmax, vidx, index);
+    }
+#endif
+    for(;i<n;i++){
+        if(x[i] > max){
+            max = x[i];
+            index = i;
+        }
+    }
+    return max;
+}
+
+float kernel_norm_max_index(const std::complex<float> *x, int n, int &index)
+{
+    int i = 0;
+    float max = -INFINITY;
+    index = 0;
+#if defined(__AVX2__)
+    if(n>=8){
+        __m256 vmax = norm8(x);
+        __m256i vidx = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+        __m256i vcur = vidx;
+        __m256i vstep = _mm256_set1_epi32(8);
+        for(i=8;i+8<=n;i+=8){
+            __m256 v = norm8(x+i);
+            vcur = _mm256_add_epi32(vcur, vstep);
+            __m256 gt = _mm256_cmp_ps(v, vmax, _CMP_GT_OQ);
+            vmax = _mm256_blendv_ps(vmax, v, gt);
+            vidx = _mm256_castps_si256(_mm256_blendv_ps(
+                _mm256_castsi256_ps(vidx), _mm256_castsi256_ps(vcur), gt));
+        }
+        max = argmax_reduce(vmax, vidx, index);
+    }
+#elif defined(__SSE2__)
+    if(n>=4){
+        __m128 vmax = norm4(x);
+        __m128i vidx = _mm_setr_epi32(0,1,2,3);
+        __m128i vcur = vidx;
+        __m128i vstep = _mm_set1_epi32(4);
+        for(i=4;i+4<=n;i+=4){
+            __m128 v = norm4(x+i);
+            vcur = _mm_add_epi32(vcur, vstep);
+            __m128 gt = _mm_cmpgt_ps(v, vmax);
+            vmax = _mm_or_ps(_mm_and_ps(gt, v), _mm_andnot_ps(gt, vmax));
+            __m128 gti = _mm_and_ps(gt, _mm_castsi128_ps(vcur));
+            vidx = _mm_castps_si128(_mm_or_ps(gti, _mm_andnot_ps(gt, _mm_castsi128_ps(vidx))));
+        }
+        max = argmax_reduce(vmax, vidx, index);
+    }
+#endif
+    for(;i<n;i++){
+        float v = std::norm(x[i]);
+        if(v > max){
+            max = v;
+            index = i;
+        }
+    }
+    return max;
+}
+
+float kernel_mean(const float *x, int n)
+{
+    int i = 0;
+    float sum = 0.0f;
+#if defined(__AVX2__)
+    __m256 vsum = _mm256_setzero_ps();
+    for(;i+8<=n;i+=8){
+        vsum = _mm256_add_ps(vsum, _mm256_loadu_ps(x+i));
+    }
+    alignas(32) float s[8];
+    _mm256_store_ps(s, vsum);
+    for(int l=0;l<8;l++){
+        sum += s[l];
+    }
+#elif defined(__SSE2__)
+    __m128 vsum = _mm_setzero_ps();
+    for(;i+4<=n;i+=4){
+        vsum = _mm_add_ps(vsum, _mm_loadu_ps(x+i));
+    }
+    alignas(16) float s[4];
+    _mm_store_ps(s, vsum);
+    for(int l=0;l<4;l++){
+        sum += s[l];
+    }
+#endif
+    for(;i<n;i++){
+        sum += x[i];
+    }
+    return sum/n;
+}
+
+void kernel_epl(const std::complex<float> *x, const float *code, int n,
+                std::complex<float> *epl)
+{
+    int i = 0;
+    float acc[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+#if defined(__AVX2__)
+    // each code sample duplicated over the re,im pair it multiplies
+    __m256i vdup = _mm256_setr_epi32(0,0,1,1,2,2,3,3);
+    __m256 ve = _mm256_setzero_ps();
+    __m256 vp = _mm256_setzero_ps();
+    __m256 vl = _mm256_setzero_ps();
+    for(;i+4<=n;i+=4){
+        __m256 v = _mm256_loadu_ps(reinterpret_cast<const float*>(x+i));
+        __m256 cl = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(_mm_loadu_ps(code+i)), vdup);
+        __m256 cp = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(_mm_loadu_ps(code+i+1)), vdup);
+        __m256 ce = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(_mm_loadu_ps(code+i+2)), vdup);
+        vl = _mm256_add_ps(vl, _mm256_mul_ps(v, cl));
+        vp = _mm256_add_ps(vp, _mm256_mul_ps(v, cp));
+        ve = _mm256_add_ps(ve, _mm256_mul_ps(v, ce));
+    }
+    alignas(32) float s[3][8];
+    _mm256_store_ps(s[0], ve);
+    _mm256_store_ps(s[1], vp);
+    _mm256_store_ps(s[2], vl);
+    for(int c=0;c<3;c++){
+        for(int l=0;l<8;l+=2){
+            acc[2*c] += s[c][l];
+            acc[2*c+1] += s[c][l+1];
+        }
+    }
+#elif defined(__SSE2__)
+    __m128 ve = _mm_setzero_ps();
+    __m128 vp = _mm_setzero_ps();
+    __m128 vl = _mm_setzero_ps();
+    for(;i+2<=n;i+=2){
+        __m128 v = _mm_loadu_ps(reinterpret_cast<const float*>(x+i));
+        __m128 cl = _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(code+i)));
+        __m128 cp = _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(code+i+1)));
+        __m128 ce = _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(code+i+2)));
+        vl = _mm_add_ps(vl, _mm_mul_ps(v, _mm_unpacklo_ps(cl, cl)));
+        vp = _mm_add_ps(vp, _mm_mul_ps(v, _mm_unpacklo_ps(cp, cp)));
+        ve = _mm_add_ps(ve, _mm_mul_ps(v, _mm_unpacklo_ps(ce, ce)));
+    }
+    alignas(16) float s[3][4];
+    _mm_store_ps(s[0], ve);
+    _mm_store_ps(s[1], vp);
+    _mm_store_ps(s[2], vl);
+    for(int c=0;c<3;c++){
+        acc[2*c] += s[c][0] + s[c][2];
+        acc[2*c+1] += s[c][1] + s[c][3];
+    }
+#endif
+    for(;i<n;i++){
+        acc[0] += x[i].real()*code[i+2];
+        acc[1] += x[i].imag()*code[i+2];
+        acc[2] += x[i].real()*code[i+1];
+        acc[3] += x[i].imag()*code[i+1];
+        acc[4] += x[i].real()*code[i];
+        acc[5] += x[i].imag()*code[i];
+    }
+    epl[0] = std::complex<float>(acc[0], acc[1]);
+    epl[1] = std::complex<float>(acc[2], acc[3]);
+    epl[2] = std::complex<float>(acc[4], acc[5]);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <complex>
+
+//
+// Vectorized inner loops shared by the search and the tracking
+// channels. Each kernel has AVX2 and SSE2 paths selected at compile
+// time and a scalar fallback. Arrays need no particular alignment.
+//
+
+// acc[i] += |x[i]|
+void kernel_acc_abs(float *acc, const std::complex<float> *x, int n);
+// acc[i] += |x[i]|^2
+void kernel_acc_norm(float *acc, const std::complex<float> *x, int n);
+// largest x[i], index receives the first i holding it
+float kernel_max_index(const float *x, int n, int &index);
+// largest |x[i]|^2, index receives the first i holding it
+float kernel_norm_max_index(const std::complex<float> *x, int n, int &index);
+// mean of x[0..n-1]
+float kernel_mean(const float *x, int n);
+// early, prompt and late correlation of x against a real replica
+// padded as in PRNS::prns_code, epl[0] = sum x[i]*code[i+2],
+// epl[1] = sum x[i]*code[i+1], epl[2] = sum x[i]*code[i]
+void kernel_epl(const std::complex<float> *x, const float *code, int n,
+                std::complex<float> *epl);
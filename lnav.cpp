@@ -54,6 +54,10 @@ LNAV::LNAV(void)
         bit_fill>>=1;
     }
     bit_fill_mask[BITS_PER_WORD] = 0;
+    for(int s=0;s<3;s++){
+        ephemeris_held[s] = false;
+    }
+    ephemeris_valid = false;
 }
 
 
@@ -209,6 +213,10 @@ bool LNAV::subframe_decode(int &subframe, long sample_index)
         return false;
     }
     subframe = word_read(subframe_decoded[1], 20, 22);
+    if(subframe<1 || subframe>SUBFRAMES_PER_FRAME){
+        printf("Invalid subframe ID:%d\n", subframe);
+        return false;
+    }
     // decode the TLM and HOW words
     TLM_HOW_decode(subframe, sample_index);
 
@@ -216,10 +224,36 @@ bool LNAV::subframe_decode(int &subframe, long sample_index)
     for(int w=0;w<WORDS_PER_SUBFRAME;w++){
         frame[subframe-1][w] = subframe_decoded[w];
     }
+    if(subframe<=3){
+        ephemeris_held[subframe-1] = true;
+    }
     return true;
 }
 
-void LNAV::frame_decode(int &page)
+//
+// Decodes the ephemeris once subframes 1, 2 and 3 are all held and
+// belong to the same issue, the 8 LSBs of IODC matching IODE in
+// subframes 2 and 3. Across an upload the held subframes disagree and
+// the previously decoded ephemeris stays in use until a matching set
+// has been received. Returns true when a new set was decoded.
+//
+bool LNAV::ephemeris_update(void)
+{
+    if(!ephemeris_held[0] || !ephemeris_held[1] || !ephemeris_held[2])
+        return false;
+    int iodc_lsb = word_read(frame[SUBFRAME1][WORD8], 1, 8);
+    int iode2 = word_read(frame[SUBFRAME2][WORD3], 1, 8);
+    int iode3 = word_read(frame[SUBFRAME3][WORD10], 1, 8);
+    if(iodc_lsb!=iode2 || iode2!=iode3)
+        return false;
+    if(ephemeris_valid && iode2==IODE2 && iode3==IODE3)
+        return false;
+    ephemeris_decode();
+    ephemeris_valid = true;
+    return true;
+}
+
+void LNAV::ephemeris_decode(void)
 {
     // Decode subframe 1
     int word3 = frame[SUBFRAME1][WORD3];
@@ -281,10 +315,12 @@ void LNAV::frame_decode(int &page)
     C_is = sword_read(frame[SUBFRAME3][WORD5], 1, 16)*scale_factor(-29);
     IODE2 = word_read(frame[SUBFRAME2][WORD3], 1, 8);
     IODE3 = word_read(frame[SUBFRAME3][WORD10], 1, 8);
+}
 
-    // Subframe 5
+void LNAV::almanac_decode(int &page)
+{
     int sv_id = word_read(frame[SUBFRAME5][WORD3], 3, 8);
-    if(sv_id<=24){
+    if(sv_id>=1 && sv_id<=24){
         page = sv_id;
         subframe5_decode(&svs[sv_id-1]);
     }else{
@@ -361,9 +397,9 @@ double LNAV::t_k(double t)
     return t_k_r;
 }
 
-double LNAV::gps_time(int subframe)
+// GPS time of a transmission at SV time t_sv, 20.3.3.3.3.1
+double LNAV::gps_time(double t_sv)
 {
-    double t_sv = tlm_how[subframe-1].time_of_week*6;
     double delta_t_sv = 0.0;
     for(int i=0;i<2;i++){
         double t = t_sv - delta_t_sv;
@@ -375,9 +411,9 @@ double LNAV::gps_time(int subframe)
     return t_sv - delta_t_sv;
 }
 
-SatelliteFix LNAV::calculate_position(int subframe)
+SatelliteFix LNAV::calculate_position(double t_sv, long sample_index)
 {
-    double t = gps_time(subframe);
+    double t = gps_time(t_sv);
     double v_k = 2.0*std::atan(std::sqrt((1+e)/(1-e))*std::tan(E_k(t)/2));
     double Phi_k = v_k + omega;
     double delta_u_k = C_us*std::sin(2*Phi_k) + C_uc*std::cos(2*Phi_k);
@@ -397,10 +433,11 @@ SatelliteFix LNAV::calculate_position(int subframe)
     //         x_k, y_k, z_k);
     SatelliteFix fix;
     fix.gps_time = t;
-    fix.sample_index = tlm_how[subframe-1].sample_index;
+    fix.sample_index = sample_index;
     fix.x_k = x_k;
     fix.y_k = y_k;
     fix.z_k = z_k;
+    fix.snr = 1.0f;
 
     return fix;
 }
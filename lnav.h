@@ -1,3 +1,5 @@
+#pragma once
+
 /*
  *
  *
@@ -140,6 +142,12 @@ struct LNAV
     TLM_HOW tlm_how[SUBFRAMES_PER_FRAME];
     SV svs[32];
 
+    // [s]: frame has held subframe s+1 at least once. Never cleared, the
+    // IODC/IODE match is what gates a new set
+    bool ephemeris_held[3];
+    // the fields above hold a consistent subframe 1-3 set
+    bool ephemeris_valid;
+
     LNAV(void);
     int bit_parity(int Dlast, int d, int poly);
     int bit_select(int word, int bit);
@@ -154,11 +162,13 @@ struct LNAV
     bool tlm_test(int D, int &polarity);
     void subframe_set_bit(int x, int bit);
     bool subframe_decode(int &subframe, long sample_index);
-    void frame_decode(int &page);
+    bool ephemeris_update(void);
+    void ephemeris_decode(void);
+    void almanac_decode(int &page);
     void subframe5_decode(SV *scv);
     void TLM_HOW_decode(int subframe, long sample_index);
     double E_k(double t);
     double t_k(double t);
-    double gps_time(int subframe);
-    SatelliteFix calculate_position(int subframe);
+    double gps_time(double t_sv);
+    SatelliteFix calculate_position(double t_sv, long sample_index);
 };
@@ -0,0 +1,59 @@
+#include "measurement.h"
+#include <cmath>
+
+Measurement::Measurement(int fs)
+{
+    interval = fs/MEAS_RATE;
+    reset();
+}
+
+void Measurement::reset(void)
+{
+    valid = false;
+    pending = false;
+    pending_ms = 0;
+    tx_ms = 0;
+    rx_last = 0.0;
+    next_sample = 0;
+}
+
+// called when a HOW dates the code epoch ending this period, returns
+// false when the running count disagrees with it
+bool Measurement::sync(long tow_ms)
+{
+    pending = true;
+    pending_ms = tow_ms;
+    return !valid || (tx_ms+1)%MS_PER_WEEK == tow_ms;
+}
+
+//
+// Called once per code period with the receive sample rx of the code
+// epoch ending it. Returns true with the grid sample and the transmit
+// time at it when a grid sample lies in (rx_last, rx]. MEAS_RATE is at
+// most 100 Hz so there is never more than one per code period.
+//
+bool Measurement::epoch(double rx, long &sample, double &t_tx)
+{
+    if(pending){
+        pending = false;
+        valid = true;
+        tx_ms = pending_ms;
+        rx_last = rx;
+        next_sample = ((long)std::floor(rx)/interval + 1)*interval;
+        return false;
+    }
+    if(!valid)
+        return false;
+    long tx_last = tx_ms;
+    tx_ms = (tx_ms+1)%MS_PER_WEEK;
+    bool r = false;
+    if(next_sample<=rx){
+        double frac = (next_sample - rx_last)/(rx - rx_last);
+        sample = next_sample;
+        t_tx = (tx_last + frac)*1e-3;
+        next_sample += interval;
+        r = true;
+    }
+    rx_last = rx;
+    return r;
+}
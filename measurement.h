@@ -0,0 +1,32 @@
+#pragma once
+
+#define MEAS_RATE 10 // Hz, measurement epochs per second, 1 to 100
+#define MS_PER_WEEK 604800000L
+
+#if MEAS_RATE<1 || MEAS_RATE>100
+#error "MEAS_RATE must be 1 to 100 Hz"
+#endif
+
+//
+// Transmit time of a channel's code epochs. A HOW dates the code epoch
+// ending its subframe and the count then carries on one ms per code
+// period. The DLL places each epoch on the receive sample axis to a
+// fraction of a sample. Measurements are taken every fs/MEAS_RATE
+// samples on a grid shared by all channels, the transmit time at a
+// grid sample being interpolated between the code epochs either side.
+//
+struct Measurement
+{
+    long interval;    // samples between measurement epochs
+    bool valid;       // tx_ms dates the last code epoch
+    bool pending;     // a HOW dates the next code epoch
+    long pending_ms;
+    long tx_ms;       // transmit time of the last code epoch, ms of week
+    double rx_last;   // receive sample of the last code epoch
+    long next_sample; // next grid sample
+
+    Measurement(int fs);
+    void reset(void);
+    bool sync(long tow_ms);
+    bool epoch(double rx, long &sample, double &t_tx);
+};
@@ -2,15 +2,16 @@
 #include "lfsr.h"
 #include <cmath>
 
-PRNS::PRNS(int fs)
+PRNS::PRNS(int fs, FFTPlans &plans)
 {
     int periods_per_sample = fs/F_CHIP;
-    int samples_per_period = periods_per_sample*N_PERIOD;
-    fftwf_plan plan;
+    samples_per_period = periods_per_sample*N_PERIOD;
+    acq_size = 0;
+    fftwf_plan plan = plans.shared_dft(samples_per_period, 1, FFTW_FORWARD);
 
-    std::unique_ptr<std::complex<float>[]> prn(new std::complex<float>[samples_per_period]);
+    AlignedBuffer<std::complex<float>> prn(aligned_new<std::complex<float>>(samples_per_period));
     for(int s=0;s<N_SATELLITES;s++){
-        prns_fft[s].reset(new std::complex<float>[samples_per_period]);
+        prns_fft[s].reset(aligned_new<std::complex<float>>(samples_per_period));
         std::unique_ptr<CA> ca(new CA(s+1));
         int i=0;
         for(int c=0;c<N_PERIOD;c++){
@@ -19,12 +20,13 @@ PRNS::PRNS(int fs)
                 prn[i++] = x;
             }
         }
-        plan = fftwf_plan_dft_1d(samples_per_period,
-                                 reinterpret_cast<fftwf_complex*>(prn.get()),
-                                 reinterpret_cast<fftwf_complex*>(prns_fft[s].get()),
-                                 FFTW_FORWARD, FFTW_ESTIMATE);
-        fftwf_execute(plan);
-        fftwf_destroy_plan(plan);
+        prns_code[s].reset(aligned_new<float>(samples_per_period+2));
+        for(i=0;i<samples_per_period;i++){
+            prns_code[s][i+1] = prn[i].real();
+        }
+        prns_code[s][0] = prn[samples_per_period-1].real();
+        prns_code[s][samples_per_period+1] = prn[0].real();
+        FFTPlans::execute(plan, prn.get(), prns_fft[s].get());
         for(i=0;i<samples_per_period;i++){
             prns_fft[s][i] = std::conj(prns_fft[s][i]);
         }
@@ -35,3 +37,33 @@ std::complex<float>* PRNS::prn_fft(int s)
 {
     return prns_fft[s].get();
 }
+
+void PRNS::set_acq_size(int n)
+{
+    acq_size = n;
+    acq_bins.reset(new int[n]);
+    // signed frequencies representable at the sample rate
+    int q_min = -(samples_per_period/2);
+    int q_max = (samples_per_period-1)/2;
+    for(int s=0;s<N_SATELLITES;s++){
+        prns_acq[s].reset(aligned_new<std::complex<float>>(n));
+    }
+    for(int j=0;j<n;j++){
+        int q = (j<n/2)?j:j-n;
+        bool mapped = (q>=q_min) && (q<=q_max);
+        acq_bins[j] = (!mapped)?0:(q<0)?q+samples_per_period:q;
+        for(int s=0;s<N_SATELLITES;s++){
+            prns_acq[s][j] = (mapped)?prns_fft[s][acq_bins[j]]:0.0f;
+        }
+    }
+}
+
+std::complex<float>* PRNS::prn_acq(int s)
+{
+    return prns_acq[s].get();
+}
+
+float* PRNS::prn_code(int s)
+{
+    return prns_code[s].get();
+}
@@ -1,13 +1,34 @@
 #pragma once
 
 #include "constants.h"
+#include "fft_plans.h"
+#include "aligned_buffer.h"
 #include <complex>
 #include <fftw3.h>
 #include <memory>
 
+//
+// prns_fft holds the conjugated spectra of the code replicas at the
+// sample rate. prns_acq holds the same spectra resampled to the
+// acquisition transform size, acq_bins[j] being the samples_per_period
+// bin that acquisition bin j takes its value from. Bins without a
+// counterpart are zeroed.
+//
+// prns_code holds the time domain replicas for the tracking
+// correlators, padded by one sample on each side so that
+// prns_code[s][k] is the replica sample (k-1) mod samples_per_period.
+//
 struct PRNS
 {
-    std::unique_ptr<std::complex<float>[]> prns_fft[N_SATELLITES];
-    PRNS(int fs);
+    int samples_per_period;
+    int acq_size;
+    std::unique_ptr<int[]> acq_bins;
+    AlignedBuffer<std::complex<float>> prns_fft[N_SATELLITES];
+    AlignedBuffer<std::complex<float>> prns_acq[N_SATELLITES];
+    AlignedBuffer<float> prns_code[N_SATELLITES];
+    PRNS(int fs, FFTPlans &plans);
     std::complex<float> *prn_fft(int s);
+    void set_acq_size(int n);
+    std::complex<float> *prn_acq(int s);
+    float *prn_code(int s);
 };
@@ -1,42 +1,44 @@
 #include "satellite.h"
 #include "gps.h"
 #include "constants.h"
+#include "kernels.h"
 #include <stdio.h>
 #include <cmath>
+#include <algorithm>
 
 #define COSTAS_FREQ_MAX (1.0/8.0/0.001)
 #define COSTAS_PHASE_MAX (M_PI/4.0)
 #define COSTAS_FREQ_FACTOR 0.0005
 #define COSTAS_PHASE_FACTOR 0.01
 #define PLL_ERROR_STATS_SIZE 5
-#define SENSOR_N_DATA 17
+#define DLL_GAIN 0.25f
+#define DLL_MISS_MAX 10
+#define DLL_LOCK_PERIODS 10
+#define DLL_SLIP 0.75f // filtered residual, in samples, that reverses the last slip
+#define BITSYNC_MIN_TRANSITIONS 10
+#define BITSYNC_CONFIDENCE 0.6f // share of the transitions in the edge bin
+#define BITSYNC_TIMEOUT 4000 // periods before an unresolved histogram restarts
+#define BITSYNC_DECAY 0.99f // per bit once synchronized
+#define BITSYNC_MOVE_RATIO 2.0f // another bin must beat the edge by this to move it
+#define SNR_GAIN 0.01f // per period smoothing of the prompt powers
 
 Satellite::Satellite(GPSRx &gpsrx, int sat, int fs, float freq)
-    :gpsrx(gpsrx), sat(sat), f_offset_avg(5),
-    pll_error_stats(PLL_ERROR_STATS_SIZE), dco(fs)
+    :gpsrx(gpsrx), sat(sat), shard(0), f_offset_avg(5),
+    pll_error_stats(PLL_ERROR_STATS_SIZE), dco(fs), measurement(fs)
 {
     printf("Satellite::Satellite sat:%d fs:%d freq:%f\n",
            sat+1, fs, freq);
     int samples_per_chip = fs/F_CHIP;
     samples_per_period = samples_per_chip*N_PERIOD;
-    rx_buff.reset(new std::complex<float>[samples_per_period]);
-    rx_buff_fft.reset(new std::complex<float>[samples_per_period]);
-    prod_fft.reset(new std::complex<float>[samples_per_period]);
-    corr.reset(new std::complex<float>[samples_per_period]);
-    sensor_iq.reset(new std::complex<float>[SENSOR_N_DATA]);
-    sensor_iq_index = 0;
-    rx_plan = fftwf_plan_dft_1d(
-        samples_per_period,
-        reinterpret_cast<fftwf_complex*>(rx_buff.get()),
-        reinterpret_cast<fftwf_complex*>(rx_buff_fft.get()),
-        FFTW_FORWARD, FFTW_ESTIMATE);
-    corr_plan = fftwf_plan_dft_1d(
-        samples_per_period,
-        reinterpret_cast<fftwf_complex*>(prod_fft.get()),
-        reinterpret_cast<fftwf_complex*>(corr.get()),
-        FFTW_BACKWARD, FFTW_ESTIMATE);
+    rx_buff.reset(aligned_new<std::complex<float>>(samples_per_period));
+    rx_buff_fft.reset(aligned_new<std::complex<float>>(samples_per_period));
+    prod_fft.reset(aligned_new<std::complex<float>>(samples_per_period));
+    corr.reset(aligned_new<std::complex<float>>(samples_per_period));
+    rx_plan = gpsrx.plans.shared_dft(samples_per_period, 1, FFTW_FORWARD);
+    corr_plan = gpsrx.plans.shared_dft(samples_per_period, 1, FFTW_BACKWARD);
 
     dco.set_frequency(-freq);
+    carrier_freq = freq;
     buffer_index = 0;
     offset = 0;
     offset_range_max = samples_per_chip/4;
@@ -50,19 +52,22 @@ Satellite::Satellite(GPSRx &gpsrx, int sat, int fs, float freq)
     preamble_buff = 0;
     n_valid_iq = 0;
     n_invalid_iq = 0;
-    bit_acquire_reset = true;
+    ms_index = 0;
+    bit_sync_reset();
     bit_sign = 1.0f;
-    first_subframe_processed = false;
+    n_subframes = 0;
     rxstate = RXSTATE_OFFSET_ACQUIRE;
-    sat_thread = std::thread(&Satellite::thread_func, this);
+    code_locked = false;
+    code_error = 0.0f;
+    code_slip = 0;
+    n_code_misses = 0;
+    prompt_i2 = 0.0f;
+    prompt_q2 = 0.0f;
     gpsrx.sensors->send_add_sat(sat);
 }
 
 Satellite::~Satellite(){
-    fftwf_destroy_plan(rx_plan);
-    fftwf_destroy_plan(corr_plan);
     gpsrx.sensors->send_del_sat(sat);
-    sat_thread.join();
     printf("Satellite::~Satellite satellite:%d\n", sat+1);
 }
 
@@ -72,70 +77,104 @@ bool Satellite::is_active(void)
 }
 
 
-void Satellite::send_ssiq(std::shared_ptr<SSIQ> ssiq)
+// run by the channel scheduler over samples [begin,end) of a buffer,
+// the blocks arriving in sample order
+void Satellite::process(const SSIQ &ssiq, int begin, int end)
 {
-    queue.push(ssiq);
+    int i = begin;
+    while(i<end){
+        if(rxstate == RXSTATE_SIGNAL_LOST)
+            return;
+        // offset compensation
+        if(buffer_index==0){
+            if(offset>0){
+                // skip samples
+                int n = std::min(offset, end-i);
+                dco.skip(n);
+                offset -= n;
+                i += n;
+                continue;
+            }else if(offset<0){
+                // copy samples from the previous buffer
+                for(;offset<0;offset++,buffer_index++){
+                    rx_buff[buffer_index] = rx_buff[samples_per_period+offset];
+                }
+            }
+        }
+        // mix up to the end of the period or of the block
+        int n = std::min(samples_per_period-buffer_index, end-i);
+        dco.mix(&ssiq.iq[i], &rx_buff[buffer_index], n);
+        buffer_index += n;
+        i += n;
+        if(buffer_index == samples_per_period){
+            sample_index = ssiq.sample_index + i - 1;
+            period();
+            buffer_index = 0;
+        }
+    }
 }
 
-void Satellite::thread_func(void)
+void Satellite::period(void)
 {
-    //printf("Satellite::thread_func Starting.\n");
-    while(true){
-        std::shared_ptr<SSIQ> ssiq = queue.pop();
-        //printf("Satellite::thread_func received a ssiq. N_samples:%d\n", ssiq->N_samples);
-        sample_index = ssiq->sample_index;
-        for(int i=0;i<ssiq->N_samples;i++){
-            x_in = ssiq->iq[i];
-            evaluate();
-            if(rxstate == RXSTATE_SIGNAL_LOST)
-                return;
-            sample_index++;
+    carrier_freq = -dco.get_frequency();
+    if(++ms_index==BITSYNC_BINS)
+        ms_index = 0;
+    bool offset_valid = (code_locked)?track_code():acquire_code();
+    if(offset_valid){
+        if(rxstate == RXSTATE_FREQUENCY_ACQUIRE){
+            frequency();
+        }else{
+            phase();
         }
     }
+    measure();
 }
 
-void Satellite::evaluate(void)
+//
+// The code epoch ending this period arrives code_error samples after
+// the nominal start of the next buffer, code_error being the DLL's
+// filtered estimate of the alignment residual and offset the slip it
+// has just asked for, already taken out of code_error. Measurements
+// need that sub-sample code phase so they are only taken while the
+// early/prompt/late correlators track.
+//
+void Satellite::measure(void)
 {
-    std::complex<float> x = x_in*dco.evaluate();
-    // offset compensation
-    if(buffer_index==0){
-        if(offset>0){
-            // skip this sample
-            offset--;
-            return;
-        }else if(offset<0){
-            // copy samples from the previous buffer
-            for(;offset<0;offset++,buffer_index++){
-                rx_buff[buffer_index] = rx_buff[samples_per_period+offset];
-            }
-        }
-    }
-    rx_buff[buffer_index] = x;
-    if(++buffer_index == samples_per_period){
-        period();
-        buffer_index = 0;
+    if(!code_locked){
+        measurement.reset();
+        return;
     }
+    double rx = sample_index + 1 + offset + code_error;
+    long sample;
+    double t_sv;
+    if(!measurement.epoch(rx, sample, t_sv) || !lnav.ephemeris_valid)
+        return;
+    SatelliteFix fix = lnav.calculate_position(t_sv, sample);
+    fix.snr = (prompt_q2>0.0f)?prompt_i2/prompt_q2:0.0f;
+    gpsrx.triangulator.send_add_message(shard+1, sat, fix);
 }
 
-void Satellite::period(void)
+void Satellite::lock_code(void)
+{
+    code_locked = true;
+    code_error = 0.0f;
+    code_slip = 0;
+    n_code_misses = 0;
+}
+
+// full fft correlation, returns true when the carrier loops may run
+bool Satellite::acquire_code(void)
 {
-    fftwf_execute(rx_plan);
+    FFTPlans::execute(rx_plan, rx_buff.get(), rx_buff_fft.get());
     std::complex<float> *rx_fft = rx_buff_fft.get();
     std::complex<float> *prn_fft = gpsrx.prns.prn_fft(sat);
     std::complex<float> *prod = prod_fft.get();
     for(int i=0;i<samples_per_period;i++){
         *(prod++) = *(rx_fft++) * *(prn_fft++);
     }
-    fftwf_execute(corr_plan);
-    float abs_max = 0.0f;
-    std::complex<float> *c = corr.get();
-    for(int i=0;i<samples_per_period;i++,c++){
-        float abs = std::abs(*c);
-        if(abs > abs_max){
-            abs_max = abs;
-            offset_max = i;
-        }
-    }
+    FFTPlans::execute(corr_plan, prod_fft.get(), corr.get());
+    kernel_norm_max_index(corr.get(), samples_per_period, offset_max);
+    prompt = corr[offset_max];
     offset = offset_max;
     if(offset > samples_per_period/2){
         offset -= samples_per_period;
@@ -152,30 +191,83 @@ void Satellite::period(void)
         if(n_valid_offsets==10){
             printf("Offset Acquired. Satellite:%2d\n", sat+1);
             rxstate = RXSTATE_FREQUENCY_ACQUIRE;
+            lock_code();
         }
         if(n_invalid_offsets==10){
             printf("Offset couldn't be acquired. Satellite:%2d\n", sat+1);
             rxstate = RXSTATE_SIGNAL_LOST;
         }
-    }else if(rxstate > RXSTATE_OFFSET_ACQUIRE){
-        if(!offset_valid){
-            if(++n_invalid_offsets==10){
-                printf("Offset lost: Satellite:%2d offset:%d\n", sat+1, offset);
-                rxstate = RXSTATE_SIGNAL_LOST;
-            }else{
-                offset = 0;
-                offset_max = 0;
-            }
-            return;
+        return false;
+    }
+    if(!offset_valid){
+        n_valid_offsets = 0;
+        if(++n_invalid_offsets==10){
+            printf("Offset lost: Satellite:%2d offset:%d\n", sat+1, offset);
+            rxstate = RXSTATE_SIGNAL_LOST;
         }else{
-            n_invalid_offsets = 0;
+            offset = 0;
+            offset_max = 0;
         }
-        if(rxstate == RXSTATE_FREQUENCY_ACQUIRE){
-            frequency();
-        }else{
-            phase();
+        return false;
+    }
+    n_invalid_offsets = 0;
+    if(++n_valid_offsets==DLL_LOCK_PERIODS){
+        printf("Offset recovered. Satellite:%2d\n", sat+1);
+        lock_code();
+    }
+    return true;
+}
+
+// early/prompt/late correlation, returns true when the carrier loops may run
+bool Satellite::track_code(void)
+{
+    kernel_epl(rx_buff.get(), gpsrx.prns.prn_code(sat), samples_per_period, epl);
+    prompt = epl[1];
+    float early = std::abs(epl[0]);
+    float late = std::abs(epl[2]);
+    float prompt_abs = std::abs(prompt);
+    offset = 0;
+    if(prompt_abs<early || prompt_abs<late){
+        if(++n_code_misses==DLL_MISS_MAX){
+            printf("Code lock lost, searching the offset. Satellite:%2d\n", sat+1);
+            code_locked = false;
+            n_valid_offsets = 0;
+            n_invalid_offsets = 0;
+            return false;
         }
+    }else{
+        n_code_misses = 0;
+    }
+    //
+    // With k samples per chip the correlation triangle falls to zero k
+    // samples either side of the peak. For the peak at tau samples,
+    // |tau|<1, early = 1-(1+tau)/k and late = 1-(1-tau)/k
+    // so (late-early)/(late+early) = tau/(k-1).
+    //
+    // code_error filters tau, the residual of the buffer alignment. A
+    // slip moves the alignment a sample so it takes the slip with it.
+    // Slips in the direction of the last one, code Doppler or dropped
+    // samples, happen at half a sample, reversing one takes DLL_SLIP
+    // so a residual near half a sample can't slip back and forth.
+    //
+    int samples_per_chip = samples_per_period/N_PERIOD;
+    float sum = early + late;
+    if(sum>0.0f){
+        float tau = (late - early)/sum*(samples_per_chip - 1);
+        code_error += DLL_GAIN*(tau - code_error);
+    }
+    float slip_late = (code_slip<0)?DLL_SLIP:0.5f;
+    float slip_early = (code_slip>0)?DLL_SLIP:0.5f;
+    if(code_error>slip_late){
+        offset = 1;
+        code_slip = 1;
+        code_error -= 1.0f;
+    }else if(code_error<-slip_early){
+        offset = -1;
+        code_slip = -1;
+        code_error += 1.0f;
     }
+    return true;
 }
 
 double Satellite::fix_angle_range(double angle)
@@ -190,8 +282,8 @@ double Satellite::fix_angle_range(double angle)
 
 void Satellite::frequency(void)
 {
-    std::complex<float> iq = corr[offset_max];
-    sensor_iq_evaluate(iq);
+    std::complex<float> iq = prompt;
+    gpsrx.sensors->send_sat_iq(sat, iq);
     float phase = arg(iq);
     if(phase_reset){
         phase_reset = false;
@@ -226,8 +318,11 @@ void Satellite::frequency(void)
 
 void Satellite::phase(void)
 {
-    std::complex<float> iq = corr[offset_max];
-    sensor_iq_evaluate(iq);
+    std::complex<float> iq = prompt;
+    gpsrx.sensors->send_sat_iq(sat, iq);
+    // with the carrier locked the data sits in I and Q is noise
+    prompt_i2 += SNR_GAIN*(iq.real()*iq.real() - prompt_i2);
+    prompt_q2 += SNR_GAIN*(iq.imag()*iq.imag() - prompt_q2);
     //
     // costas loop
     //
@@ -272,7 +367,8 @@ void Satellite::phase(void)
         if(valid_iq){
             if(++n_valid_iq == 200){
                 printf("PLL locked. satellite:%d\n", sat+1);
-                //rxstate = RXSTATE_BIT_ACQUIRE;
+                bit_sync_reset();
+                rxstate = RXSTATE_BIT_ACQUIRE;
             }
         }else{
             n_valid_iq = 0;
@@ -286,37 +382,82 @@ void Satellite::phase(void)
         }else{
             n_invalid_iq=0;
         }
-        if(rxstate==RXSTATE_BIT_ACQUIRE){
-            if(bit_acquire_reset){
-                bit_acquire_reset = false;
-            }else{
-                if(iq_sign!=iq_sign_last){
-                    printf("Bit transition acquired. satellite:%d\n", sat+1);
-                    n_periods = 0;
-                    rxstate = RXSTATE_PREAMBLE_ACQUIRE;
-                    sign_total = 0.0f;
-                }
-            }
-            iq_sign_last = iq_sign;
+        bit_sync(iq, iq_sign);
+    }
+}
+
+void Satellite::bit_sync_reset(void)
+{
+    for(int i=0;i<BITSYNC_BINS;i++){
+        bit_hist[i] = 0.0f;
+    }
+    n_transitions = 0;
+    n_bitsync_ms = 0;
+    bit_edge = 0;
+    bit_started = false;
+    soft_total = 0.0f;
+}
+
+//
+// Every prompt sign change is counted against the ms_index it occurs
+// at. Data transitions only happen at the bit edge so that bin grows
+// while noise spreads over all of them. The edge is committed once it
+// holds BITSYNC_CONFIDENCE of the transitions and is tracked from then
+// on with a decaying histogram. Bits are decided by the sign of the
+// summed prompt, a weak bit simply being a less certain one.
+//
+void Satellite::bit_sync(std::complex<float> iq, float iq_sign)
+{
+    if(n_bitsync_ms++ && iq_sign!=iq_sign_last){
+        bit_hist[ms_index] += 1.0f;
+        n_transitions++;
+    }
+    iq_sign_last = iq_sign;
+    int peak_bin;
+    float peak = kernel_max_index(bit_hist, BITSYNC_BINS, peak_bin);
+    if(rxstate==RXSTATE_BIT_ACQUIRE){
+        if(n_transitions>=BITSYNC_MIN_TRANSITIONS &&
+           peak>=BITSYNC_CONFIDENCE*n_transitions){
+            printf("Bit sync. satellite:%d edge:%d transitions:%d\n",
+                   sat+1, peak_bin, n_transitions);
+            bit_edge = peak_bin;
+            bit_started = false;
+            rxstate = RXSTATE_PREAMBLE_ACQUIRE;
+        }else if(n_bitsync_ms==BITSYNC_TIMEOUT){
+            printf("Bit sync timed out. satellite:%d transitions:%d\n",
+                   sat+1, n_transitions);
+            bit_sync_reset();
         }else{
-            sign_total += iq_sign;
-            if(++n_periods == 20){
-                sign_total /= 20;
-                float sign_total_abs = abs(sign_total);
-                if(sign_total_abs>0.0f){
-                    int b = ((sign_total*bit_sign)>0.0f)?1:0;
-                    register_bit(b);
-                }else{
-                    printf("Sign total was zero. satellite:%d\n", sat+1);
-                    rxstate = RXSTATE_BIT_ACQUIRE;
-                    bit_acquire_reset = true;
-                    first_subframe_processed = false;
-                }
-                n_periods = 0;
-                sign_total = 0.0f;
-            }
+            return;
         }
     }
+    if(ms_index==bit_edge){
+        bit_started = true;
+        soft_total = 0.0f;
+    }
+    if(!bit_started)
+        return;
+    soft_total += iq.real();
+    if(ms_index!=(bit_edge+BITSYNC_BINS-1)%BITSYNC_BINS)
+        return;
+    // end of a bit
+    int b = ((soft_total*bit_sign)>0.0f)?1:0;
+    bool moved = (peak_bin!=bit_edge && peak>BITSYNC_MOVE_RATIO*bit_hist[bit_edge]);
+    for(int i=0;i<BITSYNC_BINS;i++){
+        bit_hist[i] *= BITSYNC_DECAY;
+    }
+    if(moved){
+        printf("Bit edge moved. satellite:%d edge:%d->%d\n", sat+1, bit_edge, peak_bin);
+        bit_edge = peak_bin;
+        bit_started = false;
+        // the ms count was dated from the old edge and a subframe in
+        // progress is misaligned, find the preamble again
+        measurement.reset();
+        preamble_buff = 0;
+        rxstate = RXSTATE_PREAMBLE_ACQUIRE;
+        return;
+    }
+    register_bit(b);
 }
 
 void Satellite::register_bit(int b)
@@ -344,14 +485,30 @@ void Satellite::register_bit(int b)
             printf("Received a subframe.\n");
             if(lnav.subframe_decode(subframe, sample_index)){
                 printf("Decoded a subframe. subframe:%d\n", subframe);
-                if(subframe == 1){
-                    first_subframe_processed = true;
-                }else if(subframe==5 && first_subframe_processed){
+                n_subframes++;
+                if(subframe<=3 && lnav.ephemeris_update()){
+                    printf("Ephemeris decoded. Satellite:%2d IODE:%d subframes:%d\n",
+                           sat+1, lnav.IODE2, n_subframes);
+                    gpsrx.ephemeris_store.update_ephemeris(sat, lnav);
+                }else if(subframe==5){
                     int page;
-                    lnav.frame_decode(page);
-                    printf("Decoded a frame. page:%d\n", page);
-                    SatelliteFix fix = lnav.calculate_position(subframe);
-                    gpsrx.triangulator.send_add_message(sat, fix);
+                    lnav.almanac_decode(page);
+                    printf("Decoded an almanac page. page:%d\n", page);
+                    if(page>=1 && page<=24){
+                        gpsrx.almanac.update(page-1, lnav.svs[page-1]);
+                        gpsrx.ephemeris_store.update_almanac(page-1, lnav);
+                    }
+                }
+                // hot start, the first HOW dates a stored ephemeris
+                if(!lnav.ephemeris_valid && gpsrx.ephemeris_store.restore(sat, lnav, subframe)){
+                    printf("Ephemeris restored. Satellite:%2d IODE:%d subframes:%d\n",
+                           sat+1, lnav.IODE2, n_subframes);
+                }
+                // every subframe's HOW dates the code epoch it ended on
+                long tow_ms = lnav.tlm_how[subframe-1].time_of_week*6000L;
+                if(!measurement.sync(tow_ms)){
+                    printf("Measurement ms count slipped. Satellite:%2d tx_ms:%ld tow_ms:%ld\n",
+                           sat+1, measurement.tx_ms+1, tow_ms);
                 }
             }else{
                 rxstate = RXSTATE_SIGNAL_LOST;
@@ -360,13 +517,3 @@ void Satellite::register_bit(int b)
         }
     }
 }
-
-void Satellite::sensor_iq_evaluate(std::complex<float> x)
-{
-    sensor_iq[sensor_iq_index] = x;
-    if(++sensor_iq_index==SENSOR_N_DATA){
-        gpsrx.sensors->send_sat_data(sat, SENSOR_N_DATA, std::move(sensor_iq));
-        sensor_iq_index = 0;
-        sensor_iq.reset(new std::complex<float>[SENSOR_N_DATA]);
-    }
-}
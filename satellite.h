@@ -12,6 +12,10 @@
  *      e) offset feedback to stage 2
  *      if(offset_acquired)
  *          f) phase discriminator and frequency feedback to stage 1
+ * 4) once the offset is acquired the vectorize stage is replaced by
+ *    early, prompt and late correlators against the code replica, the
+ *    early/late discriminator feeding single sample slips to stage 2.
+ *    Losing the prompt peak falls back to the fft correlator.
  *
  *
  *
@@ -22,13 +26,16 @@
  */
 
 #include "dco.h"
-#include "queue.h"
 #include "ssiq.h"
 #include "moving_avg.h"
 #include "lnav.h"
-#include <thread>
+#include "measurement.h"
+#include "aligned_buffer.h"
+#include <atomic>
 #include <fftw3.h>
 
+#define BITSYNC_BINS 20 // periods per navigation bit
+
 struct GPSRx;
 
 enum RxState
@@ -46,6 +53,7 @@ struct Satellite
 {
     GPSRx &gpsrx;
     int sat;
+    int shard; // set by the channel scheduler, port shard+1 of the triangulator
     long sample_index;
     int samples_per_period;
     int buffer_index;
@@ -58,47 +66,59 @@ struct Satellite
     bool phase_reset;
     float phase_last;
     float dphase_avg;
-    int n_periods;
     int n_valid_iq;
     int n_invalid_iq;
-    bool bit_acquire_reset;
     float iq_sign_last;
-    float sign_total;
+    int ms_index; // period count modulo BITSYNC_BINS
+    float bit_hist[BITSYNC_BINS]; // sign transitions seen at each ms_index
+    int n_transitions;
+    int n_bitsync_ms;
+    int bit_edge; // ms_index that starts a bit
+    bool bit_started;
+    float soft_total;
     float bit_sign;
     int preamble_buff;
     int subframe_bit_count;
     int subframe;
-    bool first_subframe_processed;
+    int n_subframes; // decoded since the preamble was found
     MovingAvg  f_offset_avg;
     MovingStats pll_error_stats;
     RxState rxstate;
-    std::complex<float> x_in;
-    std::unique_ptr<std::complex<float>[]> rx_buff;
-    std::unique_ptr<std::complex<float>[]> rx_buff_fft;
-    std::unique_ptr<std::complex<float>[]> prod_fft;
-    std::unique_ptr<std::complex<float>[]> corr;
-    std::unique_ptr<std::complex<float>[]> sensor_iq;
-    int sensor_iq_index;
-    fftwf_plan rx_plan;
+    bool code_locked; // tracking with the early/prompt/late correlators
+    float code_error; // filtered residual of the buffer alignment in samples
+    int code_slip; // direction of the last one sample slip
+    int n_code_misses;
+    std::complex<float> prompt;
+    std::complex<float> epl[3];
+    float prompt_i2; // smoothed prompt powers, their ratio weights the fixes
+    float prompt_q2;
+    std::atomic<float> carrier_freq; // tracked carrier for search aiding
+    AlignedBuffer<std::complex<float>> rx_buff;
+    AlignedBuffer<std::complex<float>> rx_buff_fft;
+    AlignedBuffer<std::complex<float>> prod_fft;
+    AlignedBuffer<std::complex<float>> corr;
+    fftwf_plan rx_plan; // shared, owned by gpsrx.plans
     fftwf_plan corr_plan;
-    std::thread sat_thread;
-    ThreadQueue<std::shared_ptr<SSIQ>> queue;
     DCO dco;
     LNAV lnav;
+    Measurement measurement;
 public:
     Satellite(GPSRx &gpsrx, int sat, int fs, float freq);
     ~Satellite();
     bool is_active(void);
-    void send_ssiq(std::shared_ptr<SSIQ> ssiq);
-    void thread_func(void);
-    void evaluate(void); // expects x_in to be set
+    void process(const SSIQ &ssiq, int begin, int end);
     void period(void);
+    void measure(void);
+    void lock_code(void);
+    bool acquire_code(void);
+    bool track_code(void);
     double fix_angle_range(double angle);
     void frequency(void);
     void phase(void);
+    void bit_sync_reset(void);
+    void bit_sync(std::complex<float> iq, float iq_sign);
     void register_transition(int t);
     void register_bit(int b);
-    void sensor_iq_evaluate(std::complex<float> x);
 };
 
 
@@ -0,0 +1,163 @@
+#include "scheduler.h"
+#include "satellite.h"
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+// number of shards a scheduler made with n_workers will have
+int ChannelScheduler::workers(int n_workers)
+{
+    if(n_workers<=0){
+        n_workers = std::thread::hardware_concurrency()/2;
+        if(n_workers<=0)
+            n_workers = 1;
+    }
+    return n_workers;
+}
+
+ChannelScheduler::ChannelScheduler(int n_workers)
+{
+    n_shards = workers(n_workers);
+    batched = SCHED_BATCHED;
+    shards.reset(new SchedShard[n_shards]);
+    for(int i=0;i<n_shards;i++){
+        SchedShard &shard = shards[i];
+        shard.n_channels = 0;
+        shard.tasks = 0;
+        shard.queued_ns = 0;
+        shard.queued_ns_max = 0;
+        shard.tasks_last = 0;
+        shard.queued_ns_last = 0;
+        shard.thread = std::thread(&ChannelScheduler::thread_func, this, i);
+#ifdef __linux__
+        if(SCHED_PIN_CORES){
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % std::thread::hardware_concurrency(), &cpus);
+            pthread_setaffinity_np(shard.thread.native_handle(), sizeof(cpus), &cpus);
+        }
+#endif
+    }
+    printf("ChannelScheduler::ChannelScheduler shards:%d\n", n_shards);
+}
+
+ChannelScheduler::~ChannelScheduler()
+{
+    for(int i=0;i<n_shards;i++){
+        shards[i].queue.stop();
+    }
+    for(int i=0;i<n_shards;i++){
+        shards[i].thread.join();
+    }
+}
+
+void ChannelScheduler::add(Satellite *sat)
+{
+    // only GPSRx changes the counts so they can't move under us. The
+    // fullest shard short of a group, so as few shards as possible
+    // read the iq, else the one with the fewest.
+    int best = -1;
+    for(int i=0;i<n_shards;i++){
+        int n = shards[i].n_channels;
+        if(n<SCHED_GROUP_CHANNELS && (best<0 || n>shards[best].n_channels))
+            best = i;
+    }
+    if(best<0){
+        best = 0;
+        for(int i=1;i<n_shards;i++){
+            if(shards[i].n_channels<shards[best].n_channels)
+                best = i;
+        }
+    }
+    sat->shard = best;
+    std::lock_guard<std::mutex> lock(shards[best].mutex);
+    shards[best].channels.push_back(sat);
+    shards[best].n_channels++;
+}
+
+void ChannelScheduler::remove(Satellite *sat)
+{
+    SchedShard &sh = shards[sat->shard];
+    std::lock_guard<std::mutex> lock(sh.mutex);
+    auto it = std::find(sh.channels.begin(), sh.channels.end(), sat);
+    if(it != sh.channels.end()){
+        sh.channels.erase(it);
+        sh.n_channels--;
+    }
+}
+
+void ChannelScheduler::dispatch(std::shared_ptr<SSIQ> ssiq)
+{
+    ssiq->t_queued = std::chrono::steady_clock::now();
+    for(int i=0;i<n_shards;i++){
+        shards[i].queue.push(ssiq);
+    }
+}
+
+void ChannelScheduler::stats(int shard, SchedStats &s)
+{
+    SchedShard &sh = shards[shard];
+    s.channels = sh.n_channels;
+    s.depth = sh.queue.size();
+    long tasks = sh.tasks;
+    long queued_ns = sh.queued_ns;
+    long n = tasks - sh.tasks_last;
+    s.tasks = tasks;
+    s.queued_avg_ms = (n)?(queued_ns - sh.queued_ns_last)*1e-6f/n:0.0f;
+    s.queued_max_ms = sh.queued_ns_max.exchange(0)*1e-6f;
+    sh.tasks_last = tasks;
+    sh.queued_ns_last = queued_ns;
+}
+
+void ChannelScheduler::report(void)
+{
+    for(int i=0;i<n_shards;i++){
+        SchedStats s;
+        stats(i, s);
+        printf("ChannelScheduler shard:%d channels:%d depth:%d tasks:%ld queued avg:%.2fms max:%.2fms\n",
+               i, s.channels, s.depth, s.tasks, s.queued_avg_ms, s.queued_max_ms);
+    }
+}
+
+void ChannelScheduler::thread_func(int shard)
+{
+    SchedShard &sh = shards[shard];
+    while(true){
+        std::shared_ptr<SSIQ> ssiq;
+        if(!sh.queue.pop(ssiq))
+            return;
+        long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - ssiq->t_queued).count();
+        sh.queued_ns += ns;
+        long ns_max = sh.queued_ns_max;
+        while(ns>ns_max && !sh.queued_ns_max.compare_exchange_weak(ns_max, ns));
+        if(batched){
+            // a channel added between blocks starts mid buffer, process()
+            // dates its periods from the buffer's sample_index
+            for(int i=0;i<ssiq->N_samples;i+=SCHED_BLOCK_SAMPLES){
+                int end = std::min(i+SCHED_BLOCK_SAMPLES, ssiq->N_samples);
+                std::lock_guard<std::mutex> lock(sh.mutex);
+                for(Satellite *sat : sh.channels){
+                    sat->process(*ssiq, i, end);
+                }
+            }
+        }else{
+            // the channels at the start of the buffer, less any removed
+            // since, so none skips part of it
+            std::vector<Satellite*> channels;
+            {
+                std::lock_guard<std::mutex> lock(sh.mutex);
+                channels = sh.channels;
+            }
+            for(Satellite *sat : channels){
+                std::lock_guard<std::mutex> lock(sh.mutex);
+                if(std::find(sh.channels.begin(), sh.channels.end(), sat) != sh.channels.end())
+                    sat->process(*ssiq, 0, ssiq->N_samples);
+            }
+        }
+        sh.tasks++;
+    }
+}
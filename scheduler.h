@@ -0,0 +1,81 @@
+#pragma once
+
+#include "ssiq.h"
+#include "spsc_ring.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define SCHED_N_WORKERS 0 // 0 for half the hardware threads
+#define SCHED_PIN_CORES false // pin shard i to core i
+#define SCHED_BATCHED true // walk each buffer once in blocks for all channels
+#define SCHED_BLOCK_SAMPLES 2048 // 16kB of iq, stays in L1 across the channels
+#define SCHED_GROUP_CHANNELS 8 // channels a shard takes before the next is used, ~64kB each
+#define SCHED_QUEUE_SIZE 16 // buffers queued per shard, a power of two
+
+struct Satellite;
+
+//
+// The tracking channels are split into shards, each served by one
+// worker. A buffer is queued once per shard and the worker runs it
+// through every channel of the shard in turn, so a channel always sees
+// its buffers in order and on the same thread. New channels fill a
+// shard up to SCHED_GROUP_CHANNELS before the next one is used, and
+// once every shard holds a group go to the shard with the fewest. The
+// queues are lock free single producer
+// single consumer rings, GPSRx being the only producer. add() and
+// remove() take the shard's channel mutex, which the worker holds for
+// a block, or for one channel's buffer when not batched, so they wait
+// a block at most rather than a buffer. Once remove() returns the
+// channel won't be touched again and can be destroyed.
+//
+// With batched set the worker walks the buffer once, in blocks of
+// SCHED_BLOCK_SAMPLES, running every channel over a block before
+// moving to the next so that the iq is read from memory once per shard
+// rather than once per channel. Filling shards a group at a time keeps
+// that to once per SCHED_GROUP_CHANNELS channels, the price being that
+// a group shares one core. Removals can leave shards part full, the
+// channels aren't moved since a channel's fixes use its shard's
+// triangulator port.
+//
+struct SchedStats
+{
+    int channels;
+    int depth; // buffers waiting
+    long tasks;
+    float queued_avg_ms; // since the last stats() call
+    float queued_max_ms;
+};
+
+struct SchedShard
+{
+    std::mutex mutex; // guards channels
+    std::vector<Satellite*> channels;
+    std::atomic<int> n_channels; // channels.size(), read without the mutex
+    SPSCRing<std::shared_ptr<SSIQ>, SCHED_QUEUE_SIZE> queue;
+    std::thread thread;
+    std::atomic<long> tasks;
+    std::atomic<long> queued_ns;
+    std::atomic<long> queued_ns_max;
+    long tasks_last;
+    long queued_ns_last;
+};
+
+struct ChannelScheduler
+{
+    int n_shards;
+    bool batched;
+    std::unique_ptr<SchedShard[]> shards;
+public:
+    ChannelScheduler(int n_workers=SCHED_N_WORKERS);
+    static int workers(int n_workers);
+    ~ChannelScheduler();
+    void add(Satellite *sat);
+    void remove(Satellite *sat);
+    void dispatch(std::shared_ptr<SSIQ> ssiq);
+    void stats(int shard, SchedStats &s);
+    void report(void);
+    void thread_func(int shard);
+};
@@ -1,102 +1,474 @@
 #include "search.h"
 #include "dco.h"
 #include "gps.h"
+#include "kernels.h"
 #include <stdio.h>
+#include <algorithm>
+#include <cmath>
 
-Search::Search(GPSRx &gpsrx, int fs)
+SearchWorker::SearchWorker(Search &search)
+    :search(search)
+{
+    int samples_per_period = search.samples_per_period;
+    for(int i=0;i<N_EPOCHS;i++){
+        rx_conv[i].reset(aligned_new<std::complex<float>>(samples_per_period));
+        rx_conv_fft[i].reset(aligned_new<std::complex<float>>(samples_per_period));
+    }
+    int acq_size = search.acq_size;
+    int block_size = SEARCH_PRN_BLOCK*acq_size;
+    freq_prod.reset(aligned_new<std::complex<float>>(block_size));
+    corr.reset(aligned_new<std::complex<float>>(block_size));
+    corr_acc.reset(aligned_new<float>(block_size));
+
+    plan_rx = search.gpsrx.plans.shared_dft(samples_per_period, 1, FFTW_FORWARD);
+    for(int n=1;n<=SEARCH_PRN_BLOCK;n++){
+        plan_corr[n-1] = search.gpsrx.plans.shared_dft(acq_size, n, FFTW_BACKWARD);
+    }
+
+    for(int n=1;n<=SEARCH_PRN_BLOCK;n++){
+        plan_alias[n-1] = nullptr;
+    }
+    int alias_size = search.alias_size;
+    if(alias_size){
+        alias_prod.reset(aligned_new<std::complex<float>>(SEARCH_PRN_BLOCK*alias_size));
+        alias_corr.reset(aligned_new<std::complex<float>>(SEARCH_PRN_BLOCK*alias_size));
+        alias_acc.reset(aligned_new<float>(SEARCH_PRN_BLOCK*alias_size));
+        twiddles.reset(aligned_new<std::complex<float>>(acq_size));
+        for(int n=0;n<acq_size;n++){
+            twiddles[n] = std::polar(1.0f, (float)(2.0*M_PI*n/acq_size));
+        }
+        for(int n=1;n<=SEARCH_PRN_BLOCK;n++){
+            plan_alias[n-1] = search.gpsrx.plans.shared_dft(alias_size, n, FFTW_BACKWARD);
+        }
+    }
+}
+
+void SearchWorker::convert_rx(float f)
+{
+    DCO dco(search.fs);
+    dco.set_frequency(-f);
+    std::complex<float> *src = search.rx.get();
+    int samples_per_period = search.samples_per_period;
+    for(int e=0;e<search.n_epochs;e++, src+=samples_per_period){
+        dco.mix(src, rx_conv[e].get(), samples_per_period);
+        FFTPlans::execute(plan_rx, rx_conv[e].get(), rx_conv_fft[e].get());
+    }
+}
+
+void SearchWorker::product(std::complex<float> *prod, std::complex<float> *prn_acq,
+                           std::complex<float> *rx_fft, int shift, int stride)
+{
+    // prod[j] = prn_acq[j*stride]*rx_fft[(acq_bins[j*stride]+shift) mod samples_per_period]
+    int samples_per_period = search.samples_per_period;
+    int n = search.acq_size/stride;
+    int *bins = search.gpsrx.prns.acq_bins.get();
+    int k = shift % samples_per_period;
+    if(k<0)
+        k += samples_per_period;
+    for(int j=0;j<n;j++, bins+=stride, prn_acq+=stride){
+        int b = *bins + k;
+        if(b>=samples_per_period)
+            b -= samples_per_period;
+        *(prod++) = *prn_acq * rx_fft[b];
+    }
+}
+
+void SearchWorker::correlate(SearchBin &bin)
+{
+    if(search.engine == SEARCH_ENGINE_SPARSE){
+        correlate_sparse(bin);
+        return;
+    }
+    int samples_per_period = search.samples_per_period;
+    int acq_size = search.acq_size;
+    int n_cells = bin.cells.size();
+    for(int c0=0;c0<n_cells;c0+=SEARCH_PRN_BLOCK){
+        int n_block = n_cells - c0;
+        if(n_block>SEARCH_PRN_BLOCK)
+            n_block = SEARCH_PRN_BLOCK;
+        SearchCell *cells = &bin.cells[c0];
+        int block_size = n_block*acq_size;
+        float *c_acc_p = corr_acc.get();
+        for(int i=0;i<block_size;i++){
+            *(c_acc_p++) = 0.0f;
+        }
+        for(int epoch=0;epoch<search.n_epochs;epoch++){
+            std::complex<float> *prod_p = freq_prod.get();
+            for(int b=0;b<n_block;b++, prod_p+=acq_size){
+                product(prod_p, search.gpsrx.prns.prn_acq(cells[b].sat),
+                        rx_conv_fft[epoch].get(), bin.shift);
+            }
+            FFTPlans::execute(plan_corr[n_block-1], freq_prod.get(), corr.get());
+            kernel_acc_abs(corr_acc.get(), corr.get(), block_size);
+        }
+        c_acc_p = corr_acc.get();
+        for(int b=0;b<n_block;b++, c_acc_p+=acq_size){
+            int i_max;
+            float abs_max = kernel_max_index(c_acc_p, acq_size, i_max);
+            float abs_avg = kernel_mean(c_acc_p, acq_size);
+            *(cells[b].ratio) = abs_max / abs_avg;
+            // back to the sample grid
+            int offset = ((long)i_max*samples_per_period + acq_size/2)/acq_size;
+            *(cells[b].offset) = offset % samples_per_period;
+        }
+    }
+}
+
+std::complex<float> SearchWorker::correlate_lag(std::complex<float> *prod, int lag)
+{
+    // one lag of the backward transform, sum prod[j]*exp(2*pi*i*j*lag/acq_size)
+    int acq_size = search.acq_size;
+    std::complex<float> c = 0.0f;
+    for(int j=0, n=0;j<acq_size;j++){
+        c += prod[j]*twiddles[n];
+        n += lag;
+        if(n>=acq_size)
+            n -= acq_size;
+    }
+    return c;
+}
+
+void SearchWorker::correlate_sparse(SearchBin &bin)
+{
+    int samples_per_period = search.samples_per_period;
+    int acq_size = search.acq_size;
+    int alias_size = search.alias_size;
+    // the noise of a folded lag is the mean of SPARSE_ALIAS independent lags
+    float noise_gain = std::sqrt((float)SPARSE_ALIAS);
+    // any cell the FFT engine could pass at either stage is unfolded
+    float confirm_threshold = std::min(SEARCH_COARSE_THRESHOLD, SEARCH_THRESHOLD)/noise_gain;
+    int n_cells = bin.cells.size();
+    for(int c0=0;c0<n_cells;c0+=SEARCH_PRN_BLOCK){
+        int n_block = n_cells - c0;
+        if(n_block>SEARCH_PRN_BLOCK)
+            n_block = SEARCH_PRN_BLOCK;
+        SearchCell *cells = &bin.cells[c0];
+        int block_size = n_block*alias_size;
+        float *a_acc_p = alias_acc.get();
+        for(int i=0;i<block_size;i++){
+            *(a_acc_p++) = 0.0f;
+        }
+        for(int epoch=0;epoch<search.n_epochs;epoch++){
+            std::complex<float> *prod_p = alias_prod.get();
+            for(int b=0;b<n_block;b++, prod_p+=alias_size){
+                product(prod_p, search.gpsrx.prns.prn_acq(cells[b].sat),
+                        rx_conv_fft[epoch].get(), bin.shift, SPARSE_ALIAS);
+            }
+            FFTPlans::execute(plan_alias[n_block-1], alias_prod.get(), alias_corr.get());
+            kernel_acc_abs(alias_acc.get(), alias_corr.get(), block_size);
+        }
+        a_acc_p = alias_acc.get();
+        for(int b=0;b<n_block;b++, a_acc_p+=alias_size){
+            int m_max;
+            float alias_max = kernel_max_index(a_acc_p, alias_size, m_max);
+            float alias_avg = kernel_mean(a_acc_p, alias_size);
+            *(cells[b].ratio) = alias_max / alias_avg;
+            *(cells[b].offset) = 0;
+            if(alias_max < confirm_threshold*alias_avg)
+                continue;
+            // unfold the peak, correlating its candidate lags directly
+            float cand_acc[SPARSE_ALIAS];
+            for(int q=0;q<SPARSE_ALIAS;q++){
+                cand_acc[q] = 0.0f;
+            }
+            for(int epoch=0;epoch<search.n_epochs;epoch++){
+                product(freq_prod.get(), search.gpsrx.prns.prn_acq(cells[b].sat),
+                        rx_conv_fft[epoch].get(), bin.shift);
+                for(int q=0;q<SPARSE_ALIAS;q++){
+                    cand_acc[q] += std::abs(correlate_lag(freq_prod.get(), m_max + q*alias_size));
+                }
+            }
+            int q_max;
+            float abs_max = kernel_max_index(cand_acc, SPARSE_ALIAS, q_max);
+            *(cells[b].ratio) = abs_max / (alias_avg*noise_gain);
+            int lag = m_max + q_max*alias_size;
+            int offset = ((long)lag*samples_per_period + acq_size/2)/acq_size;
+            *(cells[b].offset) = offset % samples_per_period;
+        }
+    }
+}
+
+void SearchWorker::scan(void)
+{
+    // claim snapshot conversions until the grid is exhausted
+    int n_groups = search.groups.size();
+    for(int g=search.next_group++;g<n_groups;g=search.next_group++){
+        SearchGroup &group = search.groups[g];
+        //printf("SearchWorker::scan residual:%f\n", group.residual);
+        convert_rx(group.residual);
+        for(auto &bin : group.bins){
+            correlate(bin);
+        }
+    }
+}
+
+Search::Search(GPSRx &gpsrx, int fs, int n_workers)
     :fs(fs), gpsrx(gpsrx)
 {
     int samples_per_chip = fs/F_CHIP;
     samples_per_period = samples_per_chip * N_PERIOD;
     samples_per_trigger = fs*SEC_PER_TRIGGER;
     buff_size = samples_per_period*N_EPOCHS;
+    samples_per_slice = fs/1000*SEARCH_SLICE_MS;
+    if(samples_per_slice<buff_size)
+        samples_per_slice = buff_size;
     rx_index = 0;
     trigger_index = 0;
+    ring_index = 0;
+    slice_index = 0;
+    next_prn = 0;
     receiving = false;
     scanning = false;
     scan_done = false;
-
-    rx.reset(new std::complex<float>[buff_size]);
-    rx_conv.reset(new std::complex<float>[buff_size]);
-    for(int i=0;i<N_EPOCHS;i++){
-        rx_conv_fft[i].reset(new std::complex<float>[samples_per_period]);
+    mode = SEARCH_MODE;
+    two_stage = SEARCH_TWO_STAGE;
+    continuous = SEARCH_CONTINUOUS;
+    aided = SEARCH_AIDED;
+    aiding = false;
+    for(int s=0;s<N_SATELLITES;s++){
+        scan_sats[s] = true;
+    }
+    n_epochs = N_EPOCHS;
+    // the frequency spacing of the period length transforms
+    bin_hz = fs/samples_per_period;
+    acq_size = SEARCH_ACQ_SIZE;
+    if(acq_size<=0)
+        acq_size = samples_per_period;
+    gpsrx.prns.set_acq_size(acq_size);
+    engine = SEARCH_ENGINE;
+    alias_size = 0;
+    if(acq_size%SPARSE_ALIAS == 0){
+        alias_size = acq_size/SPARSE_ALIAS;
+    }else if(engine == SEARCH_ENGINE_SPARSE){
+        printf("Search::Search acq_size:%d doesn't fold by %d, using the FFT engine.\n",
+               acq_size, SPARSE_ALIAS);
+        engine = SEARCH_ENGINE_FFT;
     }
-    freq_prod.reset(new std::complex<float>[samples_per_period]);
-    corr.reset(new std::complex<float>[samples_per_period]);
-    corr_acc.reset(new float[samples_per_period]);
+
+    rx.reset(aligned_new<std::complex<float>>(buff_size));
+    ring.reset(aligned_new<std::complex<float>>(buff_size));
     ratios.reset(new float[N_FREQ*N_SATELLITES]);
+    coarse_ratios.reset(new float[N_FREQ_COARSE*N_SATELLITES]);
+    offsets.reset(new int[N_FREQ*N_SATELLITES]);
+    coarse_offsets.reset(new int[N_FREQ_COARSE*N_SATELLITES]);
 
-    std::complex<float> *rx_p = rx_conv.get();
-    for(int e=0;e<N_EPOCHS;e++, rx_p+=samples_per_period){
-        plan_rx[e] = fftwf_plan_dft_1d(
-            samples_per_period,
-            reinterpret_cast<fftwf_complex*>(rx_p),
-            reinterpret_cast<fftwf_complex*>(rx_conv_fft[e].get()),
-            FFTW_FORWARD, FFTW_ESTIMATE);
+    if(n_workers<=0){
+        n_workers = std::thread::hardware_concurrency();
+        if(n_workers<=0)
+            n_workers = 1;
+    }
+    for(int w=0;w<n_workers;w++){
+        workers.emplace_back(new SearchWorker(*this));
     }
-    plan_corr = fftwf_plan_dft_1d(
-        samples_per_period,
-        reinterpret_cast<fftwf_complex*>(freq_prod.get()),
-        reinterpret_cast<fftwf_complex*>(corr.get()),
-        FFTW_BACKWARD, FFTW_ESTIMATE);
+    printf("Search::Search workers:%d\n", n_workers);
+}
 
+Search::~Search()
+{
+    if(scan_thread.joinable()){
+        scan_thread.join();
+    }
 }
 
-void Search::convert_rx(float f)
+void Search::add_cell(float freq, int sat, float *ratio, int *offset)
 {
-    DCO dco(fs);
-    dco.set_frequency(-f);
-    std::complex<float> *src = rx.get();
-    std::complex<float> *dst = rx_conv.get();
-    for(int i=0;i<buff_size;i++){
-        *(dst++) = *(src++) * dco.evaluate();
+    int shift = 0;
+    if(mode == SEARCH_MODE_ROTATE){
+        // nearest whole bin, leaving a residual in [-bin_hz/2, bin_hz/2)
+        shift = (int)std::floor((freq + bin_hz/2)/bin_hz);
+    }
+    float residual = freq - shift*bin_hz;
+    SearchGroup *group = nullptr;
+    for(auto &g : groups){
+        if(g.residual == residual){
+            group = &g;
+            break;
+        }
+    }
+    if(!group){
+        groups.push_back(SearchGroup{residual, {}});
+        group = &groups.back();
+    }
+    SearchBin *bin = nullptr;
+    for(auto &b : group->bins){
+        if(b.shift == shift){
+            bin = &b;
+            break;
+        }
     }
-    for(int e=0;e<N_EPOCHS;e++){
-        fftwf_execute(plan_rx[e]);
+    if(!bin){
+        group->bins.push_back(SearchBin{shift, {}});
+        bin = &group->bins.back();
     }
+    bin->cells.push_back(SearchCell{sat, ratio, offset});
 }
 
-void Search::scan(void)
+void Search::run_workers(int epochs)
 {
-    printf("Search::scan Starting scan.\n");
-    float *ratio_p = ratios.get();
+    n_epochs = epochs;
+    for(auto &group : groups){
+        for(auto &bin : group.bins){
+            n_correlations += bin.cells.size()*epochs;
+        }
+    }
+    next_group = 0;
+    std::vector<std::thread> threads;
+    for(size_t w=1;w<workers.size();w++){
+        threads.emplace_back(&SearchWorker::scan, workers[w].get());
+    }
+    workers[0]->scan();
+    for(auto &thread : threads){
+        thread.join();
+    }
+    groups.clear();
+}
 
+void Search::scan_coarse(void)
+{
+    // wide bins and a short integration over every PRN
     float freq = -F_RANGE;
-    for(int f=0;f<N_FREQ;f++, freq += F_DELTA){
-        //printf("Search::scan freq:%f\n", freq);
-        convert_rx(freq);
+    for(int f=0;f<N_FREQ_COARSE;f++, freq+=F_DELTA_COARSE){
         for(int s=0;s<N_SATELLITES;s++){
-            float *c_acc_p = corr_acc.get();
-            for(int i=0;i<samples_per_period;i++){
-                *(c_acc_p++) = 0.0f;
+            coarse_ratios[f*N_SATELLITES+s] = 0.0f;
+            if(scan_sats[s]){
+                add_cell(freq, s, &coarse_ratios[f*N_SATELLITES+s],
+                         &coarse_offsets[f*N_SATELLITES+s]);
             }
-            for(int epoch=0;epoch<N_EPOCHS;epoch++){
-                std::complex<float> *prn_p = gpsrx.prns.prn_fft(s);
-                std::complex<float> *rx_p = rx_conv_fft[epoch].get();
-                std::complex<float> *prod_p = freq_prod.get();
-                for(int i=0;i<samples_per_period;i++){
-                    *(prod_p++) = *(prn_p++) * *(rx_p++);
-                }
-                fftwf_execute(plan_corr);
-                c_acc_p = corr_acc.get();
-                std::complex<float> *corr_p = corr.get();
-                for(int i=0;i<samples_per_period;i++){
-                    *(c_acc_p++) += std::abs(*(corr_p++));
-                }
+        }
+    }
+    run_workers(N_EPOCHS_COARSE);
+}
+
+void Search::scan_fine(void)
+{
+    // full integration in narrow bins around the coarse peaks
+    for(int i=0;i<N_FREQ*N_SATELLITES;i++){
+        ratios[i] = 0.0f;
+    }
+    int n_candidates = 0;
+    for(int s=0;s<N_SATELLITES;s++){
+        float *ratio_p = &coarse_ratios[s];
+        float ratio_max = 0.0f;
+        int f_max = 0;
+        for(int f=0;f<N_FREQ_COARSE;f++, ratio_p+=N_SATELLITES){
+            if(*ratio_p > ratio_max){
+                ratio_max = *ratio_p;
+                f_max = f;
             }
-            float abs_max = 0.0f;
-            float abs_avg = 0.0f;
-            c_acc_p = corr_acc.get();
-            for(int i=0;i<samples_per_period;i++, c_acc_p++){
-                if(*c_acc_p > abs_max){
-                    abs_max = *c_acc_p;
+        }
+        coarse_freq[s] = -F_RANGE + f_max*F_DELTA_COARSE;
+        if(ratio_max<SEARCH_COARSE_THRESHOLD)
+            continue;
+        n_candidates++;
+        int f_first = (f_max*F_DELTA_COARSE - F_DELTA_COARSE)/F_DELTA;
+        int f_last = (f_max*F_DELTA_COARSE + F_DELTA_COARSE)/F_DELTA;
+        if(f_first<0)
+            f_first = 0;
+        if(f_last>=N_FREQ)
+            f_last = N_FREQ-1;
+        for(int f=f_first;f<=f_last;f++){
+            add_cell(-F_RANGE + f*F_DELTA, s, &ratios[f*N_SATELLITES+s],
+                     &offsets[f*N_SATELLITES+s]);
+        }
+    }
+    printf("Search::scan_fine candidates:%d\n", n_candidates);
+    run_workers(N_EPOCHS);
+}
+
+bool Search::aid(void)
+{
+    // predict the visible PRNs from the almanac and the last position fix
+    aiding = false;
+    if(!aided)
+        return false;
+    Vector3d R;
+    double gps_time;
+    long sample_index;
+    if(!gpsrx.triangulator.last_fix(R, gps_time, sample_index))
+        return false;
+    double t = gps_time + (double)(gpsrx.sample_index - sample_index)/fs;
+    AlmanacPrediction predictions[N_SATELLITES];
+    int n_visible = gpsrx.almanac.predict(R, t, predictions);
+    if(n_visible==0)
+        return false;
+    // the receiver clock offset is common to every channel
+    float clock_offset = 0.0f;
+    int n_offsets = 0;
+    for(auto &sat : gpsrx.satellites){
+        if(predictions[sat->sat].visible){
+            clock_offset += sat->carrier_freq - predictions[sat->sat].doppler;
+            n_offsets++;
+        }
+    }
+    if(n_offsets){
+        clock_offset /= n_offsets;
+        aided_window = SEARCH_AIDED_WINDOW;
+    }else{
+        aided_window = 2*F_RANGE;
+    }
+    for(int s=0;s<N_SATELLITES;s++){
+        aided_known[s] = predictions[s].known;
+        aided_visible[s] = predictions[s].visible;
+        aided_freq[s] = predictions[s].doppler + clock_offset;
+    }
+    printf("Search::aid visible:%d clock_offset:%f\n", n_visible, clock_offset);
+    aiding = true;
+    return true;
+}
+
+void Search::scan_aided(void)
+{
+    // narrow window around the predicted Doppler of each PRN, the
+    // full range for PRNs the almanac doesn't have
+    for(int i=0;i<N_FREQ*N_SATELLITES;i++){
+        ratios[i] = 0.0f;
+    }
+    for(int s=0;s<N_SATELLITES;s++){
+        if(!scan_sats[s])
+            continue;
+        int f_first = 0;
+        int f_last = N_FREQ-1;
+        if(aided_known[s]){
+            f_first = (int)std::ceil((aided_freq[s] - aided_window + F_RANGE)/F_DELTA);
+            f_last = (int)std::floor((aided_freq[s] + aided_window + F_RANGE)/F_DELTA);
+        }
+        if(f_first<0)
+            f_first = 0;
+        if(f_last>=N_FREQ)
+            f_last = N_FREQ-1;
+        for(int f=f_first;f<=f_last;f++){
+            add_cell(-F_RANGE + f*F_DELTA, s, &ratios[f*N_SATELLITES+s],
+                     &offsets[f*N_SATELLITES+s]);
+        }
+    }
+    run_workers(N_EPOCHS);
+}
+
+void Search::scan(void)
+{
+    printf("Search::scan Starting scan.\n");
+    n_correlations = 0;
+    if(aiding){
+        scan_aided();
+    }else if(two_stage){
+        scan_coarse();
+        scan_fine();
+    }else{
+        float freq = -F_RANGE;
+        for(int f=0;f<N_FREQ;f++, freq+=F_DELTA){
+            for(int s=0;s<N_SATELLITES;s++){
+                ratios[f*N_SATELLITES+s] = 0.0f;
+                if(scan_sats[s]){
+                    add_cell(freq, s, &ratios[f*N_SATELLITES+s],
+                             &offsets[f*N_SATELLITES+s]);
                 }
-                abs_avg += *c_acc_p;
             }
-            abs_avg /= samples_per_period;
-            *(ratio_p++) = abs_max / abs_avg;
         }
+        run_workers(N_EPOCHS);
     }
+    long n_full = (long)N_FREQ*N_SATELLITES*N_EPOCHS;
+    printf("Search::scan correlations:%ld of %ld (%.1f%% saved) tracked PRNs skipped:%d\n",
+           n_correlations, n_full, 100.0*(n_full - n_correlations)/n_full, n_skipped);
     results();
     scan_done = true;
 }
@@ -109,20 +481,23 @@ void Search::results(void)
         float freq = -F_RANGE;
         float ratio_max=0.0f;
         float freq_max;
+        int offset_max;
         for(int f=0;f<N_FREQ;f++, freq+=F_DELTA, ratio_p+=N_SATELLITES){
             if(*ratio_p > ratio_max){
                 ratio_max = *ratio_p;
                 freq_max = freq;
+                offset_max = offsets[f*N_SATELLITES+s];
             }
         }
         //printf("Search::results Satellite:%2d ratio_max:%7f\n", s+1, ratio_max);
-        if(ratio_max>=3.0f){
-            found.push_back(SearchResult(s, ratio_max, freq_max));
+        if(ratio_max>=SEARCH_THRESHOLD){
+            float freq_coarse = (two_stage && !aiding)?coarse_freq[s]:freq_max;
+            found.push_back(SearchResult(s, ratio_max, freq_max, freq_coarse, offset_max));
         }
     }
     for(auto &result:found){
-        printf("Satellite:%2d ratio:%7.2f freq:%7.2f\n",
-               result.sat+1, result.ratio, result.freq);
+        printf("Satellite:%2d ratio:%7.2f freq:%7.2f offset:%4d\n",
+               result.sat+1, result.ratio, result.freq, result.offset);
     }
 }
 
@@ -135,20 +510,76 @@ void Search::start_scan(void)
     scan_thread = std::thread(&Search::scan, this);
 }
 
-void Search::evaluate(std::complex<float> x)
+void Search::start_slice(void)
 {
-    if(trigger_index == 0){
-        receiving = true;
-        rx_index = 0;
+    // unroll the most recent buff_size samples, oldest first
+    for(int i=0, r=ring_index;i<buff_size;i++){
+        rx[i] = ring[r];
+        if(++r == buff_size)
+            r = 0;
+    }
+    // test the next few PRNs that aren't being tracked
+    // and that the almanac doesn't put below the horizon
+    bool tracked[N_SATELLITES];
+    gpsrx.tracked(tracked);
+    aid();
+    int n_sats = 0;
+    n_skipped = 0;
+    for(int s=0;s<N_SATELLITES;s++){
+        scan_sats[s] = false;
+        if(tracked[s])
+            n_skipped++;
     }
-    if(++trigger_index == samples_per_trigger){
-        trigger_index = 0;
+    for(int i=0;i<N_SATELLITES && n_sats<SEARCH_SLICE_PRNS;i++){
+        if(!tracked[next_prn] && (!aiding || aided_visible[next_prn] || !aided_known[next_prn])){
+            scan_sats[next_prn] = true;
+            n_sats++;
+        }
+        if(++next_prn == N_SATELLITES)
+            next_prn = 0;
     }
-    if(receiving){
-        rx[rx_index] = x;
-        if(++rx_index == buff_size){
-            receiving = false;
-            start_scan();
+    if(n_sats)
+        start_scan();
+}
+
+void Search::evaluate(std::complex<float> x)
+{
+    if(continuous){
+        ring[ring_index] = x;
+        if(++ring_index == buff_size){
+            ring_index = 0;
+        }
+        if(++slice_index == samples_per_slice){
+            slice_index = 0;
+            if(!scanning)
+                start_slice();
+        }
+    }else{
+        if(trigger_index == 0){
+            receiving = true;
+            rx_index = 0;
+        }
+        if(++trigger_index == samples_per_trigger){
+            trigger_index = 0;
+        }
+        if(receiving){
+            rx[rx_index] = x;
+            if(++rx_index == buff_size){
+                receiving = false;
+                bool tracked[N_SATELLITES];
+                gpsrx.tracked(tracked);
+                aid();
+                n_skipped = 0;
+                for(int s=0;s<N_SATELLITES;s++){
+                    // PRNs with a channel are never searched again,
+                    // aided re-acquisition skips the ones the almanac
+                    // puts below the mask
+                    scan_sats[s] = !tracked[s] && (!aiding || aided_visible[s] || !aided_known[s]);
+                    if(tracked[s])
+                        n_skipped++;
+                }
+                start_scan();
+            }
         }
     }
     if(scanning){
@@ -1,11 +1,14 @@
 #pragma once
 
 #include "constants.h"
+#include "aligned_buffer.h"
 
 #include <thread>
+#include <atomic>
 #include <memory>
 #include <complex>
 #include <list>
+#include <vector>
 #include <fftw3.h>
 
 #define N_EPOCHS 10
@@ -13,16 +16,126 @@
 #define F_DELTA 50
 #define N_FREQ ((F_RANGE*2/F_DELTA)+1)
 #define SEC_PER_TRIGGER 10
+#define SEARCH_N_WORKERS 0 // 0 selects the hardware concurrency
+#define SEARCH_MODE SEARCH_MODE_ROTATE
+#define SEARCH_PRN_BLOCK 8 // PRNs correlated by one batched inverse transform
+#define SEARCH_ACQ_SIZE 2048 // correlation transform size, 0 for samples_per_period
+#define SEARCH_ENGINE SEARCH_ENGINE_FFT
+#define SPARSE_ALIAS 4 // acquisition bins folded into each aliased bin
+#define SEARCH_TWO_STAGE false
+#define N_EPOCHS_COARSE 4
+#define F_DELTA_COARSE 250
+#define N_FREQ_COARSE ((F_RANGE*2/F_DELTA_COARSE)+1)
+#define SEARCH_COARSE_THRESHOLD 2.7f
+#define SEARCH_THRESHOLD 3.0f
+#define SEARCH_CONTINUOUS false
+#define SEARCH_SLICE_MS 250 // continuous mode scan interval
+#define SEARCH_SLICE_PRNS 4 // untracked PRNs tested per slice
+#define SEARCH_AIDED true
+#define SEARCH_AIDED_WINDOW 500 // Hz either side of the predicted Doppler
 
 struct GPSRx;
+struct Search;
+
+//
+// SEARCH_MODE_REMIX mixes and transforms the snapshot for every Doppler
+// bin. SEARCH_MODE_ROTATE only mixes out the residual below one FFT bin
+// (fs/samples_per_period) and applies the whole bins by circularly
+// shifting the epoch spectra against the PRN spectra.
+//
+enum SearchMode
+{
+    SEARCH_MODE_REMIX,
+    SEARCH_MODE_ROTATE
+};
+
+//
+// SEARCH_ENGINE_FFT correlates every lag of a cell with a full acq_size
+// backward transform per epoch. SEARCH_ENGINE_SPARSE keeps only every
+// SPARSE_ALIAS'th bin of the product spectrum, which folds the lags
+// into a short acq_size/SPARSE_ALIAS transform, a[m] being the mean of
+// c[m + q*alias_size]. Folding leaves a peak at 1/SPARSE_ALIAS and the
+// noise at 1/sqrt(SPARSE_ALIAS), so a cell is confirmed, by correlating
+// the SPARSE_ALIAS unfolded candidate lags directly, when its aliased
+// ratio passes the lower of the search thresholds over
+// sqrt(SPARSE_ALIAS).
+//
+enum SearchEngine
+{
+    SEARCH_ENGINE_FFT,
+    SEARCH_ENGINE_SPARSE
+};
+
+struct SearchCell
+{
+    int sat;
+    float *ratio; // destination of the peak to average ratio
+    int *offset;  // destination of the peak's code phase in samples
+};
+
+struct SearchBin
+{
+    int shift; // whole FFT bins applied by rotation
+    std::vector<SearchCell> cells;
+};
+
+struct SearchGroup // Doppler bins sharing one converted snapshot
+{
+    float residual;
+    std::vector<SearchBin> bins;
+};
 
 struct SearchResult
 {
     int sat;
     float ratio;
-    float freq;
-    SearchResult(int sat, float ratio, float freq):
-        sat(sat), ratio(ratio), freq(freq){}
+    float freq;        // refined frequency
+    float coarse_freq; // coarse stage frequency, freq for a single stage scan
+    int offset;        // code phase in samples from the start of the snapshot
+    SearchResult(int sat, float ratio, float freq, float coarse_freq, int offset):
+        sat(sat), ratio(ratio), freq(freq), coarse_freq(coarse_freq), offset(offset){}
+};
+
+//
+// Each worker owns its conversion and correlation buffers, run through
+// plans shared by size, so the frequency bins of a scan can be
+// evaluated concurrently. The received snapshot and the ratio tables
+// are shared; every (freq, sat) cell is written by exactly one worker.
+//
+// freq_prod, corr and corr_acc hold SEARCH_PRN_BLOCK rows of acq_size
+// so a block of cells shares one batched backward transform and one
+// accumulation pass. A bin's last block, often its only one in aided
+// scans, runs a plan sized to the rows it actually holds. The epoch
+// spectra are resampled to acq_size as the products are formed, a
+// power of two making the backward transforms cheaper than
+// samples_per_period (2046 = 2*3*11*31).
+//
+struct SearchWorker
+{
+    Search &search;
+    AlignedBuffer<std::complex<float>> rx_conv[N_EPOCHS];
+    AlignedBuffer<std::complex<float>> rx_conv_fft[N_EPOCHS];
+    AlignedBuffer<std::complex<float>> freq_prod;
+    AlignedBuffer<std::complex<float>> corr;
+    AlignedBuffer<float> corr_acc;
+    AlignedBuffer<std::complex<float>> alias_prod;
+    AlignedBuffer<std::complex<float>> alias_corr;
+    AlignedBuffer<float> alias_acc;
+    AlignedBuffer<std::complex<float>> twiddles; // exp(2*pi*i*n/acq_size)
+
+    // shared, owned by gpsrx.plans
+    fftwf_plan plan_rx;
+    fftwf_plan plan_corr[SEARCH_PRN_BLOCK]; // [n-1] transforms n rows
+    fftwf_plan plan_alias[SEARCH_PRN_BLOCK];
+
+    SearchWorker(Search &search);
+    void convert_rx(float f);
+    void correlate(SearchBin &bin);
+    void correlate_sparse(SearchBin &bin);
+    std::complex<float> correlate_lag(std::complex<float> *prod, int lag);
+    void product(std::complex<float> *prod, std::complex<float> *prn_acq,
+                 std::complex<float> *rx_fft, int shift, int stride=1);
+    void scan(void);
 };
 
 struct Search
@@ -31,34 +144,63 @@ struct Search
     GPSRx &gpsrx;
     int rx_index;
     int trigger_index;
+    int ring_index;
+    int slice_index;
+    int next_prn;
     int samples_per_period;
+    int acq_size;
+    int alias_size;
     int samples_per_trigger;
+    int samples_per_slice;
     int buff_size;
     bool receiving;
     bool scanning;
     bool scan_done;
+    SearchMode mode;
+    SearchEngine engine;
+    bool two_stage;
+    bool continuous;
+    bool aided;
+    bool aiding; // the running scan is almanac aided
+    int n_epochs; // epochs integrated by the running stage
+    int bin_hz;
 
     std::thread scan_thread;
 
-    std::unique_ptr<std::complex<float>[]> rx;
-    std::unique_ptr<std::complex<float>[]> rx_conv;
-    std::unique_ptr<std::complex<float>[]> rx_conv_fft[N_EPOCHS];
-    std::unique_ptr<std::complex<float>[]> freq_prod;
-    std::unique_ptr<std::complex<float>[]> corr;
-    std::unique_ptr<float[]> corr_acc;
+    AlignedBuffer<std::complex<float>> rx;
+    AlignedBuffer<std::complex<float>> ring; // continuous mode history
+    bool scan_sats[N_SATELLITES];
     std::unique_ptr<float[]> ratios;
+    std::unique_ptr<float[]> coarse_ratios;
+    std::unique_ptr<int[]> offsets;
+    std::unique_ptr<int[]> coarse_offsets;
+    float coarse_freq[N_SATELLITES];
+    bool aided_known[N_SATELLITES];   // the almanac has the PRN
+    bool aided_visible[N_SATELLITES];
+    float aided_freq[N_SATELLITES];
+    float aided_window;
+    long n_correlations; // epoch correlations computed by the running scan
+    int n_skipped;       // tracked PRNs left out of the running scan
 
     std::list<SearchResult> found;
 
-    fftwf_plan plan_rx[N_EPOCHS];
-    fftwf_plan plan_corr;
+    std::vector<std::unique_ptr<SearchWorker>> workers;
+    std::vector<SearchGroup> groups;
+    std::atomic<int> next_group;
 
-    void convert_rx(float f);
+    void add_cell(float freq, int sat, float *ratio, int *offset);
+    void run_workers(int epochs);
+    void scan_coarse(void);
+    void scan_fine(void);
+    bool aid(void);
+    void scan_aided(void);
     void scan(void);
     void results(void);
     void start_scan(void);
+    void start_slice(void);
 
 public:
-    Search(GPSRx &gpsrx, int fs);
+    Search(GPSRx &gpsrx, int fs, int n_workers=SEARCH_N_WORKERS);
+    ~Search();
     void evaluate(std::complex<float> x);
 };
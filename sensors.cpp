@@ -1,5 +1,6 @@
 #include "sensors.h"
 #include <cmath>
+#include <cstring>
 
 #define CONSTELLATION_N_POINTS 200
 
@@ -8,6 +9,7 @@ Constellation::Constellation(int sat, int N_points):
     sbuff(N_points)
 {
     plot_name = std::string("Sat ") + std::to_string(sat+1);
+    dropped = 0;
 }
 
 Constellation::~Constellation()
@@ -52,6 +54,7 @@ void Constellation::tab_item(void)
 
             ImPlot::EndPlot();
         }
+        ImGui::Text("dropped points: %ld", dropped);
         ImGui::EndTabItem();
     }
 }
@@ -189,6 +192,48 @@ void Sensors::sat_tab_items(void)
     }
 }
 
+void SensorTelemetry::push(std::complex<float> x)
+{
+    uint64_t v;
+    memcpy(&v, &x, sizeof(v));
+    unsigned long h = head.load(std::memory_order_relaxed);
+    points[h & (SENSOR_TELEMETRY_SIZE-1)].store(v, std::memory_order_relaxed);
+    head.store(h+1, std::memory_order_release);
+}
+
+int SensorTelemetry::drain(std::complex<float> *out)
+{
+    unsigned long h = head.load(std::memory_order_acquire);
+    if(h - tail > SENSOR_TELEMETRY_SIZE){
+        dropped += h - tail - SENSOR_TELEMETRY_SIZE;
+        tail = h - SENSOR_TELEMETRY_SIZE;
+    }
+    int n = 0;
+    for(unsigned long i=tail;i!=h;i++){
+        uint64_t v = points[i & (SENSOR_TELEMETRY_SIZE-1)].load(std::memory_order_relaxed);
+        memcpy(&out[n++], &v, sizeof(v));
+    }
+    // points the producer lapped while they were being read, counting
+    // the slot it may be writing right now
+    std::atomic_thread_fence(std::memory_order_acquire);
+    unsigned long h2 = head.load(std::memory_order_relaxed);
+    long lapped = (long)(h2 - tail) - SENSOR_TELEMETRY_SIZE + 1;
+    if(lapped > 0){
+        if(lapped > n)
+            lapped = n;
+        dropped += lapped;
+        n -= lapped;
+        memmove(out, out+lapped, n*sizeof(std::complex<float>));
+    }
+    tail = h;
+    return n;
+}
+
+void SensorTelemetry::clear(void)
+{
+    tail = head.load(std::memory_order_acquire);
+}
+
 void Sensors::sats_update(void)
 {
     int N_msgs = queue.size();
@@ -201,11 +246,9 @@ void Sensors::sats_update(void)
         case SMT_DEL:
             del_sat(static_cast<SensorMsgDel*>(msg.get()));
             break;
-        case SMT_DATA:
-            sat_data(static_cast<SensorMsgData*>(msg.get()));
-            break;
         }
     }
+    sats_data();
 }
 
 void Sensors::add_sat(SensorMsgAdd *msg)
@@ -223,6 +266,7 @@ void Sensors::add_sat(SensorMsgAdd *msg)
 
     // allocate the sensors for the slot
     slots[slot].reset(new SensorSlot(msg->sat, CONSTELLATION_N_POINTS));
+    telemetry[msg->sat].clear();
     sat_slot[msg->sat] = slot;
 }
 
@@ -239,15 +283,18 @@ void Sensors::del_sat(SensorMsgDel *msg)
     sat_slot[slot] = -1;
 }
 
-void Sensors::sat_data(SensorMsgData *msg)
+void Sensors::sats_data(void)
 {
-    // check for a valid slot
-    int slot = sat_slot[msg->sat];
-    if(slot<0)
-        return;
-
-    for(int i=0;i<msg->N_data;i++){
-        slots[slot]->constellation.data_point(msg->iq[i]);
+    std::complex<float> iq[SENSOR_TELEMETRY_SIZE];
+    for(int s=0;s<N_SATELLITES;s++){
+        int n = telemetry[s].drain(iq);
+        int slot = sat_slot[s];
+        if(slot<0)
+            continue;
+        for(int i=0;i<n;i++){
+            slots[slot]->constellation.data_point(iq[i]);
+        }
+        slots[slot]->constellation.dropped = telemetry[s].dropped;
     }
 }
 
@@ -261,8 +308,13 @@ void Sensors::send_del_sat(int sat)
     queue.push(std::make_unique<SensorMsgDel>(sat));
 }
 
-void Sensors::send_sat_data(int sat, int N_data, std::unique_ptr<std::complex<float>[]> iq)
+void Sensors::send_sat_iq(int sat, std::complex<float> iq)
+{
+    telemetry[sat].push(iq);
+}
+
+long Sensors::dropped(int sat)
 {
-    queue.push(std::make_unique<SensorMsgData>(sat, N_data, std::move(iq)));
+    return telemetry[sat].dropped;
 }
 
@@ -1,7 +1,9 @@
 #ifndef SENSORS_H
 #define SENSORS_H
 
+#include <atomic>
 #include <complex>
+#include <cstdint>
 #include <thread>
 #include <memory>
 #include "queue.h"
@@ -14,6 +16,7 @@
 #include <string>
 
 #define N_SATELLITES 32
+#define SENSOR_TELEMETRY_SIZE 256 // points per satellite, a power of two
 
 struct ScrollingBuffer {
     int MaxSize;
@@ -47,6 +50,7 @@ class Constellation
     ScrollingBuffer sbuff;
     std::string plot_name;
 public:
+    long dropped; // telemetry points overwritten before they were drawn
     Constellation(int sat, int N_points);
     ~Constellation();
     void data_point(std::complex<float> x);
@@ -58,11 +62,33 @@ class Frequency
 
 };
 
+//
+// Tracking channels publish their prompt correlator values into a per
+// satellite ring owned by Sensors. The channel stores the point and
+// advances head, overwriting the oldest point if the GUI has fallen
+// behind or gone away; it never allocates or waits. The GUI thread
+// drains whatever is still in the ring and counts the points that were
+// overwritten before it got to them. Points are packed into 64 bit
+// atomics so they can't be torn, at worst a point being read while it
+// is overwritten shows up as the newer point.
+//
+struct SensorTelemetry
+{
+    std::atomic<uint64_t> points[SENSOR_TELEMETRY_SIZE];
+    std::atomic<unsigned long> head;
+    unsigned long tail; // GUI thread only
+    std::atomic<long> dropped;
+    SensorTelemetry():
+        head(0), tail(0), dropped(0) {}
+    void push(std::complex<float> x);
+    int drain(std::complex<float> *out); // out[SENSOR_TELEMETRY_SIZE]
+    void clear(void);
+};
+
 enum SensorMsgType
 {
     SMT_ADD,
-    SMT_DEL,
-    SMT_DATA
+    SMT_DEL
 };
 
 struct SensorMsg
@@ -91,19 +117,6 @@ struct SensorMsgDel : SensorMsgSat
         SensorMsgSat(SMT_DEL, sat){}
 };
 
-struct SensorMsgData : SensorMsgSat
-{
-    int N_data;
-    std::unique_ptr<std::complex<float>[]> iq;
-    SensorMsgData(int sat,
-                  int N_data,
-                  std::unique_ptr<std::complex<float>[]> iq)
-        : SensorMsgSat(SMT_DATA, sat),
-        N_data(N_data), iq(std::move(iq))
-    {
-    }
-};
-
 
 struct SensorSlot
 {
@@ -117,6 +130,7 @@ class Sensors
     int sat_slot[N_SATELLITES];
     std::unique_ptr<SensorSlot> slots[N_SATELLITES];
     ThreadQueue<std::unique_ptr<SensorMsg>> queue;
+    SensorTelemetry telemetry[N_SATELLITES];
     std::thread thread;
     bool thread_enabled;
     void thread_func(void);
@@ -124,13 +138,14 @@ class Sensors
     void sats_update(void);
     void add_sat(SensorMsgAdd *msg);
     void del_sat(SensorMsgDel *msg);
-    void sat_data(SensorMsgData *msg);
+    void sats_data(void);
 public:
     Sensors(void);
     ~Sensors(void);
     void send_add_sat(int sat);
     void send_del_sat(int sat);
-    void send_sat_data(int sat, int N_data, std::unique_ptr<std::complex<float>[]> iq);
+    void send_sat_iq(int sat, std::complex<float> iq);
+    long dropped(int sat);
 };
 
 #endif // SENSORS_H
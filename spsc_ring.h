@@ -0,0 +1,150 @@
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <thread>
+#include <utility>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//
+// Doorbell lets a consumer sleep until a producer has published
+// something. ring() is one atomic add, plus a futex wake only when a
+// consumer is actually waiting. Several rings can share one doorbell
+// so a consumer can wait on all of its inputs at once.
+//
+class Doorbell
+{
+    std::atomic<int> seq{0};
+    std::atomic<int> waiters{0};
+public:
+    void ring(void)
+    {
+        seq.fetch_add(1);
+        if(waiters.load()){
+#ifdef __linux__
+            syscall(SYS_futex, reinterpret_cast<int*>(&seq), FUTEX_WAKE_PRIVATE, INT_MAX,
+                    nullptr, nullptr, 0);
+#endif
+        }
+    }
+
+    // returns once ready() returns true, ready() is retried after every ring
+    template <class Ready>
+    void wait(Ready ready)
+    {
+        while(!ready()){
+            waiters.fetch_add(1);
+            int s = seq.load();
+            if(ready()){
+                waiters.fetch_sub(1);
+                return;
+            }
+#ifdef __linux__
+            syscall(SYS_futex, reinterpret_cast<int*>(&seq), FUTEX_WAIT_PRIVATE, s,
+                    nullptr, nullptr, 0);
+#else
+            std::this_thread::yield();
+#endif
+            waiters.fetch_sub(1);
+        }
+    }
+};
+
+//
+// Bounded single producer single consumer ring of N slots, N a power of
+// two. The producer only writes head and the consumer only writes
+// tail, each on its own cache line, so neither side takes a lock or
+// allocates. Popping moves the element out and leaves the slot empty,
+// a popped shared_ptr isn't kept alive by the ring.
+//
+// push() yields while the ring is full. pop() sleeps on the doorbell
+// while it is empty and returns false once the ring is stopped and
+// drained.
+//
+template <class T, int N>
+class SPSCRing
+{
+    static_assert((N & (N-1)) == 0, "SPSCRing size must be a power of two");
+    // padded rather than aligned, C++14 new ignores extended alignment
+    std::atomic<unsigned> head{0}; // next slot to write
+    char head_pad[64];
+    std::atomic<unsigned> tail{0}; // next slot to read
+    char tail_pad[64];
+    T slots[N];
+    std::atomic<bool> stopped{false};
+    Doorbell own_doorbell;
+    Doorbell *doorbell;
+
+public:
+    SPSCRing(Doorbell *doorbell=nullptr)
+        :doorbell((doorbell)?doorbell:&own_doorbell){}
+
+    // data is moved from only when there was room
+    bool try_push(T &data)
+    {
+        unsigned h = head.load(std::memory_order_relaxed);
+        if(h - tail.load(std::memory_order_acquire) == N)
+            return false;
+        slots[h & (N-1)] = std::move(data);
+        head.store(h+1, std::memory_order_release);
+        doorbell->ring();
+        return true;
+    }
+
+    void push(T data)
+    {
+        while(!try_push(data)){
+            std::this_thread::yield();
+        }
+    }
+
+    // the oldest element or nullptr, consumer only
+    T *front(void)
+    {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        if(head.load(std::memory_order_acquire) == t)
+            return nullptr;
+        return &slots[t & (N-1)];
+    }
+
+    bool try_pop(T &data)
+    {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        if(head.load(std::memory_order_acquire) == t)
+            return false;
+        data = std::move(slots[t & (N-1)]);
+        slots[t & (N-1)] = T();
+        tail.store(t+1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &data)
+    {
+        bool popped = false;
+        doorbell->wait([&]{
+            popped = try_pop(data);
+            return popped || stopped.load();
+        });
+        return popped;
+    }
+
+    void stop(void)
+    {
+        stopped = true;
+        doorbell->ring();
+    }
+
+    bool is_stopped(void)
+    {
+        return stopped.load();
+    }
+
+    int size(void)
+    {
+        return head.load() - tail.load();
+    }
+};
@@ -0,0 +1,90 @@
+#include "ssiq.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define HUGE_PAGE_BYTES (2UL<<20)
+
+SSIQPool::SSIQPool(int samples_per_buffer, int n_buffers)
+    :samples_per_buffer(samples_per_buffer)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    buffer_bytes = samples_per_buffer*sizeof(std::complex<float>);
+    buffer_bytes = (buffer_bytes + page - 1)/page*page;
+    map_bytes = buffer_bytes*n_buffers;
+    map_bytes = (map_bytes + HUGE_PAGE_BYTES - 1)/HUGE_PAGE_BYTES*HUGE_PAGE_BYTES;
+    mem = mmap(nullptr, map_bytes, PROT_READ|PROT_WRITE,
+               MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    mapped = (mem != MAP_FAILED);
+    if(mapped){
+#ifdef MADV_HUGEPAGE
+        madvise(mem, map_bytes, MADV_HUGEPAGE);
+#endif
+    }else{
+        printf("SSIQPool::SSIQPool mmap failed, using the heap.\n");
+        mem = aligned_new<char>(map_bytes);
+    }
+    // touch every page now rather than on the first pass
+    char *p = static_cast<char*>(mem);
+    for(size_t i=0;i<map_bytes;i+=page){
+        p[i] = 0;
+    }
+    for(int i=0;i<n_buffers;i++){
+        std::complex<float> *iq = reinterpret_cast<std::complex<float>*>(p + i*buffer_bytes);
+        slots.push_back(std::make_shared<SSIQ>(samples_per_buffer, iq));
+    }
+    next_slot = 0;
+    n_acquired = 0;
+    n_exhausted = 0;
+    max_in_use = 0;
+    printf("SSIQPool::SSIQPool buffers:%d bytes:%zu\n", n_buffers, map_bytes);
+}
+
+SSIQPool::~SSIQPool()
+{
+    slots.clear();
+    if(mapped){
+        munmap(mem, map_bytes);
+    }else{
+        free(mem);
+    }
+}
+
+std::shared_ptr<SSIQ> SSIQPool::acquire(long sample_index)
+{
+    n_acquired++;
+    int n = slots.size();
+    for(int i=0;i<n;i++){
+        int s = (next_slot + i) % n;
+        if(slots[s].use_count() == 1){
+            // pairs with the release of the last holder's reference
+            std::atomic_thread_fence(std::memory_order_acquire);
+            next_slot = (s + 1) % n;
+            SSIQ *ssiq = slots[s].get();
+            ssiq->sample_index = sample_index;
+            int used = in_use() + 1;
+            if(used > max_in_use)
+                max_in_use = used;
+            return slots[s];
+        }
+    }
+    n_exhausted++;
+    return std::make_shared<SSIQ>(sample_index, samples_per_buffer);
+}
+
+int SSIQPool::in_use(void)
+{
+    int used = 0;
+    for(auto &slot : slots){
+        if(slot.use_count() > 1)
+            used++;
+    }
+    return used;
+}
+
+void SSIQPool::report(void)
+{
+    printf("SSIQPool in use:%d of %d max:%d acquired:%ld exhausted:%ld\n",
+           in_use(), (int)slots.size(), max_in_use, n_acquired, n_exhausted);
+}
@@ -1,16 +1,55 @@
 #pragma once
 
+#include "aligned_buffer.h"
+#include <atomic>
+#include <chrono>
 #include <complex>
 #include <memory>
+#include <vector>
+
+#define SSIQ_POOL_SIZE 8 // buffers, 0.8s of samples at F_BUFFER 10
 
 struct SSIQ // sample stamped iq data
 {
     long sample_index;
     int  N_samples;
-    std::unique_ptr<std::complex<float>[]> iq;
+    std::complex<float> *iq;
+    AlignedBuffer<std::complex<float>> storage; // empty when iq is pooled
+    std::chrono::steady_clock::time_point t_queued;
     SSIQ(long sample_index, int N_samples)
         :sample_index(sample_index),
         N_samples(N_samples),
-        iq(new std::complex<float>[N_samples]){}
+        storage(aligned_new<std::complex<float>>(N_samples)){ iq = storage.get(); }
+    SSIQ(int N_samples, std::complex<float> *iq)
+        :sample_index(0), N_samples(N_samples), iq(iq){}
 };
 
+//
+// A fixed set of SSIQ buffers handed out in turn by acquire(). The
+// pool keeps one reference to every buffer, so a buffer is free again
+// once its use_count() falls back to 1, that is once GPSRx and the
+// last shard have dropped it. The iq memory is one anonymous mapping,
+// page aligned and advised for huge pages, faulted in at construction
+// so that steady state makes no allocator or kernel calls. When every
+// buffer is still in use acquire() falls back to a heap allocated SSIQ
+// and counts the miss.
+//
+struct SSIQPool
+{
+    int samples_per_buffer;
+    size_t buffer_bytes;
+    size_t map_bytes;
+    void *mem;
+    bool mapped;
+    std::vector<std::shared_ptr<SSIQ>> slots;
+    int next_slot;
+    long n_acquired;
+    long n_exhausted;
+    int max_in_use;
+public:
+    SSIQPool(int samples_per_buffer, int n_buffers=SSIQ_POOL_SIZE);
+    ~SSIQPool();
+    std::shared_ptr<SSIQ> acquire(long sample_index);
+    int in_use(void);
+    void report(void);
+};
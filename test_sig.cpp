@@ -24,6 +24,7 @@ TestSignal::TestSignal(float fs, int sat_id, float freq, float dfreq, float dT,
     freq_index = 0;
     samples_per_ramp = fs*dT;
     ramp_up = true;
+    lo_index = 0;
 }
 
 std::complex<float> TestSignal::evaluate(void)
@@ -42,26 +43,34 @@ std::complex<float> TestSignal::evaluate(void)
     if(chip_index==0){
         chip_value = (ca.advance())?1.0f:-1.0f;
     }
-    if(samples_per_ramp){
-        float t = (float)freq_index/samples_per_ramp;
-        float f;
-        if(ramp_up){
-            f = freq + dfreq*t;
-        }else{
-            f = freq + dfreq*(1.0f-t);
-        }
-        dco.set_frequency(f);
-        if(++freq_index==samples_per_ramp){
-            freq_index = 0;
+    if(lo_index==0){
+        if(samples_per_ramp){
+            // the ramp steps once per chunk
+            float t = (float)freq_index/samples_per_ramp;
+            float f;
             if(ramp_up){
-                ramp_up = false;
+                f = freq + dfreq*t;
             }else{
-                ramp_up = true;
+                f = freq + dfreq*(1.0f-t);
+            }
+            dco.set_frequency(f);
+            freq_index += DCO_CHUNK;
+            if(freq_index>=samples_per_ramp){
+                freq_index -= samples_per_ramp;
+                if(ramp_up){
+                    ramp_up = false;
+                }else{
+                    ramp_up = true;
+                }
             }
         }
+        dco.generate(lo, DCO_CHUNK);
     }
     x = chip_value*0.00015f;
-    x *= dco.evaluate();
+    x *= lo[lo_index];
+    if(++lo_index==DCO_CHUNK){
+        lo_index = 0;
+    }
     x += std::complex<float>(dist(gen), dist(gen));
 
     if(++chip_index==samples_per_chip){
@@ -26,6 +26,8 @@ class TestSignal
     int freq_index;
     int samples_per_ramp;
     bool ramp_up;
+    std::complex<float> lo[DCO_CHUNK]; // carrier, generated a chunk at a time
+    int lo_index;
     std::mt19937 gen;
     std::normal_distribution<float> dist;
     std::chrono::steady_clock::time_point target_time;
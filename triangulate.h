@@ -1,7 +1,11 @@
 #pragma once
 
-#include "queue.h"
-#include <list>
+#include "constants.h"
+#include "spsc_ring.h"
+#include "measurement.h"
+#include <atomic>
+#include <vector>
+#include <mutex>
 #include <thread>
 #include <memory>
 #include <Eigen/Dense>
@@ -15,6 +19,25 @@ struct SatelliteFix
     double x_k;
     double y_k;
     double z_k;
+    float snr; // prompt I/Q power ratio of the channel, the fix's weight
+};
+
+#define TRI_PORT_SIZE 16 // messages per port, a power of two
+#define TRI_MAX_ITERATIONS 10
+#define TRI_CONVERGENCE 1e-3 // m, position and clock step that ends the iteration
+#define TRI_MIN_WEIGHT 0.1f  // floor on the snr weight of a fix
+#define TRI_REPORT_PERIOD 1  // s of samples between printed solutions
+#define TRI_EPOCHS (MEAS_RATE/F_BUFFER+2) // open epochs, a buffer's worth and one more
+
+typedef Matrix<double, Dynamic, 4, 0, N_SATELLITES, 4> TriMatrix;
+typedef Matrix<double, Dynamic, 1, 0, N_SATELLITES, 1> TriVector;
+
+// the fixes of one measurement epoch while they are collected
+struct TriEpoch
+{
+    long sample_index;
+    bool has[N_SATELLITES];
+    SatelliteFix fixs[N_SATELLITES];
 };
 
 enum TMsgType
@@ -29,8 +52,9 @@ class TriangulateMessage
 public:
     TMsgType type;
     int sat;
+    long seq; // send order across the ports
     TriangulateMessage(TMsgType type, int sat):
-        type(type), sat(sat){}
+        type(type), sat(sat), seq(0){}
 };
 
 class TriangulateAddMessage : public TriangulateMessage
@@ -48,28 +72,60 @@ public:
         TriangulateMessage(TYPE_DEL, sat){}
 };
 
+//
+// Messages arrive on one SPSC ring per producer, port 0 for GPSRx and
+// port i+1 for channel scheduler shard i, all sharing one doorbell.
+// Each message is stamped with a send sequence number and the oldest
+// head across the ports is taken first, so a channel's last add can't
+// overtake the delete GPSRx sends after removing it.
+//
+typedef SPSCRing<std::unique_ptr<TriangulateMessage>, TRI_PORT_SIZE> TriangulatePort;
+
 class Triangulator
 {
     int fs; // sample rate
     std::thread thread;
-    ThreadQueue<std::unique_ptr<TriangulateMessage>> queue;
-    std::list<TriangulateAddMessage> collected_sats;
-    SatelliteFix fixs[4];
+    Doorbell doorbell;
+    std::vector<std::unique_ptr<TriangulatePort>> ports;
+    std::atomic<long> next_seq;
+    std::atomic<bool> stopping;
+    bool sat_valid[N_SATELLITES]; // the PRN is sending fixes
+    TriEpoch epochs[TRI_EPOCHS];  // open epochs, oldest first
+    int n_epochs;
+    long epoch_window;        // samples an epoch stays open behind the newest
+    long closed_sample_index; // newest epoch solved or dropped
+    int n_fixs;
+    int fix_sats[N_SATELLITES];
+    SatelliteFix fixs[N_SATELLITES];  // the epoch's fixes being solved
+    std::mutex fix_mutex;
+    bool fix_valid;
+    long n_solves;     // solved epochs and the iterations they took
+    long n_iterations;
+    long report_sample_index; // epoch of the last printed solution
+    Vector3d fix_position;
+    double fix_gps_time;   // transmit time of the reference fix
+    long fix_sample_index; // receive sample of the reference fix
     void thread_func(void);
+    bool next_message(std::unique_ptr<TriangulateMessage> &tm);
+    void send(int port, std::unique_ptr<TriangulateMessage> tm);
     void add_sat(TriangulateAddMessage *tam);
     void del_sat(TriangulateDelMessage *tdm);
-    Vector4d jacobian_vec(int f, Vector4d &X);
-    Matrix4d jacobian(Vector4d &X); // X(x,y,z,bias)
-    double func(int f, Vector4d &X);
-    Vector4d dY(Vector4d &X);
+    int open_epoch(long sample_index);
+    void close_epoch(void);
+    void close_complete(void);
+    void linearize(Vector4d &X, TriMatrix &H, TriVector &r);
+    int solve(Vector4d &X);
+    void report(Vector4d &X, int iterations, bool seeded);
+    bool bancroft(Vector4d &X);
     Vector4d X_guess(void);
     void gps_coordinates(Vector4d &X);
-    void triangulate(void);
+    void triangulate(TriEpoch &epoch);
 public:
-    Triangulator(int fs);
+    Triangulator(int fs, int n_ports);
     ~Triangulator(void);
-    void send_add_message(int sat, SatelliteFix &fix);
-    void send_del_message(int sat);
+    void send_add_message(int port, int sat, SatelliteFix &fix);
+    void send_del_message(int port, int sat);
+    bool last_fix(Vector3d &R, double &gps_time, long &sample_index);
 };
 
 
@@ -3,32 +3,75 @@
 #define c (2.99792458e8)
 #define R_EARTH 6371e3
 
-Triangulator::Triangulator(int fs)
+Triangulator::Triangulator(int fs, int n_ports)
     : fs(fs)
 {
+    fix_valid = false;
+    n_solves = 0;
+    n_iterations = 0;
+    report_sample_index = -(long)fs*TRI_REPORT_PERIOD;
+    for(int s=0;s<N_SATELLITES;s++){
+        sat_valid[s] = false;
+    }
+    n_fixs = 0;
+    n_epochs = 0;
+    epoch_window = fs/F_BUFFER;
+    closed_sample_index = -1;
+    next_seq = 0;
+    stopping = false;
+    for(int p=0;p<n_ports;p++){
+        ports.emplace_back(new TriangulatePort(&doorbell));
+    }
     thread = std::thread(&Triangulator::thread_func, this);
 }
 
 Triangulator::~Triangulator(void)
 {
-    queue.stop();
+    stopping = true;
+    doorbell.ring();
     thread.join();
 }
 
-void Triangulator::send_add_message(int sat, SatelliteFix &fix)
+void Triangulator::send(int port, std::unique_ptr<TriangulateMessage> tm)
+{
+    tm->seq = next_seq++;
+    ports[port]->push(std::move(tm));
+}
+
+void Triangulator::send_add_message(int port, int sat, SatelliteFix &fix)
+{
+    send(port, std::make_unique<TriangulateAddMessage>(sat, fix));
+}
+
+void Triangulator::send_del_message(int port, int sat)
 {
-    queue.push(std::make_unique<TriangulateAddMessage>(sat, fix));
+    send(port, std::make_unique<TriangulateDelMessage>(sat));
 }
 
-void Triangulator::send_del_message(int sat)
+// the oldest message across the ports, false when there is none
+bool Triangulator::next_message(std::unique_ptr<TriangulateMessage> &tm)
 {
-    queue.push(std::make_unique<TriangulateDelMessage>(sat));
+    TriangulatePort *oldest = nullptr;
+    long seq = 0;
+    for(auto &port : ports){
+        std::unique_ptr<TriangulateMessage> *head = port->front();
+        if(head && (!oldest || (*head)->seq < seq)){
+            oldest = port.get();
+            seq = (*head)->seq;
+        }
+    }
+    if(!oldest)
+        return false;
+    return oldest->try_pop(tm);
 }
 
 void Triangulator::thread_func(void)
 {
     while(true){
-        std::unique_ptr<TriangulateMessage> tm = queue.pop();
+        std::unique_ptr<TriangulateMessage> tm;
+        doorbell.wait([&]{
+            return next_message(tm) || stopping.load();
+        });
         if(tm == nullptr)
             break;
         switch(tm->type){
@@ -46,85 +89,241 @@ void Triangulator::thread_func(void)
     }
 }
 
+//
+// Channels send their fixes on the common measurement grid so all the
+// fixes of an epoch share a sample_index. The shards run the same
+// buffer at different speeds so a light shard can send later epochs
+// before a busy one has sent an earlier one, and several epochs are
+// held open. An epoch is solved once every sending satellite has
+// reported it, or when it is more than a buffer behind the newest.
+// Fixes for an epoch already closed are dropped.
+//
 void Triangulator::add_sat(TriangulateAddMessage *tam)
 {
-    // search for this sat and replace the old one or add a new sat
-    std::list<TriangulateAddMessage>::iterator list_it = collected_sats.begin();
-    bool found = false;
-    for(;list_it!=collected_sats.end();){
-        if(list_it->sat == tam->sat){
-            found = true;
-            // erase the old sat
-            list_it = collected_sats.erase(list_it);
-            // insert the new sat
-            collected_sats.push_front(*tam);
-            break;
-        }
-    }
-    if(!found){
-        // wasn't found so its a new sat. Add to the end of the list.
-        collected_sats.push_front(*tam);
+    sat_valid[tam->sat] = true;
+    int e = open_epoch(tam->fix.sample_index);
+    if(e<0)
+        return;
+    epochs[e].has[tam->sat] = true;
+    epochs[e].fixs[tam->sat] = tam->fix;
+    while(epochs[n_epochs-1].sample_index - epochs[0].sample_index > epoch_window){
+        close_epoch();
     }
-    triangulate();
+    close_complete();
 }
 
 void Triangulator::del_sat(TriangulateDelMessage *tdm)
 {
-    std::list<TriangulateAddMessage>::iterator list_it = collected_sats.begin();
-    for(;list_it!=collected_sats.end();){
-        if(list_it->sat == tdm->sat){
-            collected_sats.erase(list_it);
-            break;
-        }
+    sat_valid[tdm->sat] = false;
+    // the epochs may have been waiting on it
+    close_complete();
+}
+
+// index of the open epoch at sample_index, opening it if need be, -1
+// when it has already been closed
+int Triangulator::open_epoch(long sample_index)
+{
+    if(sample_index <= closed_sample_index)
+        return -1;
+    int e = 0;
+    while(e<n_epochs && epochs[e].sample_index<sample_index){
+        e++;
+    }
+    if(e<n_epochs && epochs[e].sample_index==sample_index)
+        return e;
+    if(n_epochs==TRI_EPOCHS){
+        if(e==0)
+            return -1;
+        close_epoch();
+        e--;
+    }
+    for(int i=n_epochs;i>e;i--){
+        epochs[i] = epochs[i-1];
     }
+    n_epochs++;
+    epochs[e].sample_index = sample_index;
+    for(int s=0;s<N_SATELLITES;s++){
+        epochs[e].has[s] = false;
+    }
+    return e;
 }
 
-Vector4d Triangulator::jacobian_vec(int f, Vector4d &X)
+// solves the oldest open epoch with whatever fixes it has
+void Triangulator::close_epoch(void)
 {
-    double pf_px = 2.0*(X[0] - fixs[f].x_k);
-    double pf_py = 2.0*(X[1] - fixs[f].y_k);
-    double pf_pz = 2.0*(X[2] - fixs[f].z_k);
-    double tilde_t = (double)fixs[f].sample_index/fs;
-    double pf_pb = 2.0*(tilde_t - X[3] - fixs[f].gps_time)*c*c;
+    triangulate(epochs[0]);
+    closed_sample_index = epochs[0].sample_index;
+    for(int e=1;e<n_epochs;e++){
+        epochs[e-1] = epochs[e];
+    }
+    n_epochs--;
+}
 
-    Vector4d vec(pf_px, pf_py, pf_pz, pf_pb);
-    return vec;
+//
+// A channel sends its epochs in order and the ports are merged in send
+// order, so once every sending satellite has reported an epoch nothing
+// more will arrive for the epochs before it either. Those are closed
+// with it, oldest first. Until four have reported, the satellites yet
+// to send their first fix might still, so the epoch waits.
+//
+void Triangulator::close_complete(void)
+{
+    int newest = -1;
+    for(int e=0;e<n_epochs;e++){
+        bool complete = true;
+        int n = 0;
+        for(int s=0;s<N_SATELLITES;s++){
+            if(epochs[e].has[s]){
+                n++;
+            }else if(sat_valid[s]){
+                complete = false;
+                break;
+            }
+        }
+        if(complete && n>=4)
+            newest = e;
+    }
+    for(;newest>=0;newest--){
+        close_epoch();
+    }
 }
 
-Matrix4d Triangulator::jacobian(Vector4d &X)
+//
+// Pseudorange rho = c*(tilde_t - gps_time) = |R - S| + c*bias. Returns
+// the Jacobian of the model at X and the measured less the modelled
+// pseudoranges, the clock column in metres so the normal matrix stays
+// well scaled.
+//
+void Triangulator::linearize(Vector4d &X, TriMatrix &H, TriVector &r)
 {
-    Matrix4d J;
-    for(int f=0;f<4;f++){
-        J.row(f) = jacobian_vec(f, X);
+    H.resize(n_fixs, 4);
+    r.resize(n_fixs);
+    Vector3d R = X.segment<3>(0);
+    for(int f=0;f<n_fixs;f++){
+        Vector3d S(fixs[f].x_k, fixs[f].y_k, fixs[f].z_k);
+        Vector3d d = R - S;
+        double range = d.norm();
+        double tilde_t = (double)fixs[f].sample_index/fs;
+        double rho = (tilde_t - fixs[f].gps_time)*c;
+        H.block<1,3>(f, 0) = (d/range).transpose();
+        H(f, 3) = 1.0;
+        r[f] = rho - range - X[3]*c;
     }
-    return J;
 }
 
-double Triangulator::func(int f, Vector4d &X)
+//
+// Gauss-Newton on the weighted pseudoranges using every fix of the
+// epoch. Each step is a column pivoting QR solve of the square root
+// weighted system. Returns the iterations taken, 0 when it hasn't
+// converged in TRI_MAX_ITERATIONS.
+//
+int Triangulator::solve(Vector4d &X)
 {
-    double dx = X[0] - fixs[f].x_k;
-    double dy = X[1] - fixs[f].y_k;
-    double dz = X[2] - fixs[f].z_k;
-    double tilde_t = (double)fixs[f].sample_index/fs;
-    double dt = (tilde_t - X[3] - fixs[f].gps_time)*c;
-    return dx*dx + dy*dy + dz*dz + dt*dt;
+    TriVector w(n_fixs);
+    for(int f=0;f<n_fixs;f++){
+        w[f] = std::sqrt(std::max(fixs[f].snr, TRI_MIN_WEIGHT));
+    }
+    TriMatrix H;
+    TriVector r;
+    for(int i=1;i<=TRI_MAX_ITERATIONS;i++){
+        linearize(X, H, r);
+        TriMatrix WH = w.asDiagonal()*H;
+        TriVector Wr = w.asDiagonal()*r;
+        Vector4d dX = WH.colPivHouseholderQr().solve(Wr);
+        X.segment<3>(0) += dX.segment<3>(0);
+        X[3] += dX[3]/c;
+        if(dX.cwiseAbs().maxCoeff() < TRI_CONVERGENCE)
+            return i;
+    }
+    return 0;
 }
 
-Vector4d Triangulator::dY(Vector4d &X)
+//
+// Dilution of precision from the unweighted geometry, the horizontal
+// and vertical terms rotated into the local east, north, up frame of
+// the fix, and the pseudorange residuals left by the solution.
+//
+void Triangulator::report(Vector4d &X, int iterations, bool seeded)
 {
-    return Vector4d(func(0,X),func(1,X),func(2,X),func(3,X));
+    TriMatrix H;
+    TriVector r;
+    linearize(X, H, r);
+    Matrix4d Q = (H.transpose()*H).ldlt().solve(Matrix4d::Identity());
+    Matrix3d Q_p = Q.topLeftCorner<3,3>();
+    Vector3d U = X.segment<3>(0).normalized();
+    Vector3d E = Vector3d(0,0,1).cross(U).normalized();
+    Vector3d N = U.cross(E);
+    double hdop = std::sqrt(E.dot(Q_p*E) + N.dot(Q_p*N));
+    double vdop = std::sqrt(U.dot(Q_p*U));
+    printf("Triangulator::report sats:%d seed:%s iterations:%d avg:%.2lf\n",
+           n_fixs, (seeded)?"bancroft":"centroid", iterations,
+           (double)n_iterations/n_solves);
+    printf("Triangulator::report gdop:%.2lf pdop:%.2lf hdop:%.2lf vdop:%.2lf tdop:%.2lf\n",
+           std::sqrt(Q.trace()), std::sqrt(Q_p.trace()), hdop, vdop, std::sqrt(Q(3,3)));
+    printf("Triangulator::report residuals(m) rms:%.2lf", std::sqrt(r.squaredNorm()/n_fixs));
+    for(int f=0;f<n_fixs;f++){
+        printf(" %d:%.2lf", fix_sats[f]+1, r[f]);
+    }
+    printf("\n");
+}
+
+//
+// Bancroft's closed form solution, S. Bancroft, "An Algebraic Solution
+// of the GPS Equations", IEEE AES-21 1985. With s_i = (S_i, rho_i),
+// y = (R, c*bias) and the Lorentz product <a,b> = a.b - a4*b4 each
+// pseudorange gives <s_i,s_i> - 2<s_i,y> + <y,y> = 0, linear in y once
+// Lambda = <y,y> is fixed. The least squares y(Lambda) put back into
+// Lambda = <y,y> leaves a quadratic, the root placing R nearest the
+// earth's surface being taken. Returns false when the geometry gives
+// no real root, the solver then starting from X_guess.
+//
+bool Triangulator::bancroft(Vector4d &X)
+{
+    TriMatrix B(n_fixs, 4);
+    TriVector a(n_fixs);
+    for(int f=0;f<n_fixs;f++){
+        double tilde_t = (double)fixs[f].sample_index/fs;
+        double rho = (tilde_t - fixs[f].gps_time)*c;
+        B.row(f) << fixs[f].x_k, fixs[f].y_k, fixs[f].z_k, rho;
+        a[f] = 0.5*(B.row(f).head<3>().squaredNorm() - rho*rho);
+    }
+    // M*y = u*Lambda/2 + v, M = diag(1,1,1,-1)
+    ColPivHouseholderQR<TriMatrix> qr(B);
+    Vector4d u = qr.solve(TriVector::Ones(n_fixs));
+    Vector4d v = qr.solve(a);
+    auto lorentz = [](const Vector4d &p, const Vector4d &q){
+        return p.head<3>().dot(q.head<3>()) - p[3]*q[3];
+    };
+    double E = lorentz(u, u);
+    double F = lorentz(u, v) - 1.0;
+    double G = lorentz(v, v);
+    double disc = F*F - E*G;
+    if(E==0.0 || disc<0.0)
+        return false;
+    double best = -1.0;
+    for(int sign=-1;sign<=1;sign+=2){
+        double lambda = (-F + sign*std::sqrt(disc))/E;
+        Vector4d y = u*lambda + v;
+        double height = std::abs(y.head<3>().norm() - R_EARTH);
+        if(best<0.0 || height<best){
+            best = height;
+            X.segment<3>(0) = y.head<3>();
+            X[3] = -y[3]/c;
+        }
+    }
+    return true;
 }
 
 Vector4d Triangulator::X_guess(void)
 {
     // find the average point of the satellites
     Vector3d R(0,0,0);
-    for(int f=0;f<4;f++){
+    for(int f=0;f<n_fixs;f++){
         R[0] += fixs[f].x_k;
         R[1] += fixs[f].y_k;
         R[2] += fixs[f].z_k;
     }
-    R /= 4;
+    R /= n_fixs;
     // interpolate to the surface of the earth (assuming a sphere)
     Vector3d N = R.normalized();
     Vector3d R_g = N*R_EARTH;
@@ -150,44 +349,72 @@ void Triangulator::gps_coordinates(Vector4d &X)
            longitude, latitude, X[3]);
 }
 
-void Triangulator::triangulate(void)
+void Triangulator::triangulate(TriEpoch &epoch)
 {
-    if(collected_sats.size()<4){
-        return;
+    // every satellite measured at this epoch
+    n_fixs = 0;
+    for(int s=0;s<N_SATELLITES;s++){
+        if(epoch.has[s]){
+            fix_sats[n_fixs] = s;
+            fixs[n_fixs++] = epoch.fixs[s];
+        }
     }
-
-    // pick the first four satellites for triangulation
-    int i=0;
-    for(auto &tam : collected_sats){
-        fixs[i] = tam.fix;
-        if(++i==4)
-            break;
+    if(n_fixs<4){
+        return;
     }
 
     // validate the gps_times for the satellites
-    for(i=1;i<4;i++){
-        if(abs(fixs[0].gps_time - fixs[i].gps_time)>0.5){
+    for(int i=1;i<n_fixs;i++){
+        if(std::abs(fixs[0].gps_time - fixs[i].gps_time)>0.5){
             return;
         }
     }
 
     // make all times relative to the first fix
-    for(int i=1;i<4;i++){
+    double gps_time_0 = fixs[0].gps_time;
+    long sample_index_0 = fixs[0].sample_index;
+    for(int i=1;i<n_fixs;i++){
         fixs[i].gps_time     -= fixs[0].gps_time;
         fixs[i].sample_index -= fixs[0].sample_index;
     }
     fixs[0].gps_time = 0.0;
     fixs[0].sample_index = 0;
 
-    Vector4d X = X_guess();
-    while(true){
-        Matrix4d J = jacobian(X);
-        Vector4d delta_Y = dY(X);
-        Vector4d delta_X = J.inverse()*delta_Y;
-        X -= delta_X;
-        if(delta_X.cwiseAbs().maxCoeff() < 1e-8)
-            break;
+    Vector4d X;
+    bool seeded = bancroft(X);
+    if(!seeded){
+        X = X_guess();
+    }
+    int iterations = solve(X);
+    if(!iterations){
+        printf("Triangulator::triangulate no convergence in %d iterations, sats:%d\n",
+               TRI_MAX_ITERATIONS, n_fixs);
+        return;
+    }
+
+    // every solve counts, the print is held to once per TRI_REPORT_PERIOD
+    n_solves++;
+    n_iterations += iterations;
+    if(epoch.sample_index - report_sample_index >= (long)fs*TRI_REPORT_PERIOD){
+        report_sample_index = epoch.sample_index;
+        gps_coordinates(X);
+        report(X, iterations, seeded);
     }
 
-    gps_coordinates(X);
+    std::lock_guard<std::mutex> lock(fix_mutex);
+    fix_position = X.segment<3>(0);
+    fix_gps_time = gps_time_0;
+    fix_sample_index = sample_index_0;
+    fix_valid = true;
+}
+
+bool Triangulator::last_fix(Vector3d &R, double &gps_time, long &sample_index)
+{
+    std::lock_guard<std::mutex> lock(fix_mutex);
+    if(!fix_valid)
+        return false;
+    R = fix_position;
+    gps_time = fix_gps_time;
+    sample_index = fix_sample_index;
+    return true;
 }